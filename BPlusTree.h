@@ -0,0 +1,999 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+#include "NodePool.h"
+
+/*!***********************************************************
+B+дерево с тем же интерфейсом, что у BinarySearchTree (insert,
+erase, find, equalRange, lower_bound / upper_bound, min / max,
+Iterator / ConstIterator), для больших деревьев, где узел на
+ключ - промах кэша на каждом шаге спуска:
+  - узел занимает NodeBytes байт (кратно кэш-линии) и выровнен
+    по линии; при спуске все линии следующего узла подгружаются
+    разом, поэтому их промахи перекрываются
+  - ключи и значения листа лежат двумя отдельными массивами:
+    поиск в узле идёт по плотному массиву ключей, значения
+    читаются только у найденного элемента
+  - все элементы лежат в листах, листы связаны в список prev /
+    next, поэтому шаг итератора и обход диапазона не поднимаются
+    по дереву
+  - внутренние узлы хранят только разделители: ключи левого
+    потомка не больше разделителя, ключи правого - не меньше
+  - листы и внутренние узлы берутся из двух пулов NodePool
+
+Отличия от BinarySearchTree:
+  - разыменование итератора даёт пару ссылок
+    std::pair<const K &, V &>, а не ссылку на пару: элемент не
+    хранится в узле парой
+  - в режиме Multi повторы ключа идут в порядке вставки, а не по
+    значению; min(key) / max(key) по-прежнему находят элемент с
+    наименьшим / наибольшим значением, просматривая повторы
+  - любая вставка и удаление делают недействительными все
+    итераторы: элементы сдвигаются внутри листа и между листами
+  - нет пакетных операций, операций над двумя деревьями,
+    сохранения в файл и макросов BST_*
+
+Ключи и значения хранятся в массивах узлов, поэтому должны
+конструироваться по умолчанию. Псевдоним BPlusTree - дерево с
+ключами Key и значениями Value.
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>, size_t NodeBytes = 256>
+class BasicBPlusTree
+{
+    static_assert(NodeBytes % 64 == 0, "node size must be a multiple of the cache line");
+    static_assert(std::is_default_constructible_v<K> && std::is_default_constructible_v<V>,
+                  "keys and values are stored in node arrays and must be default constructible");
+
+    //! Целые ключи в естественном порядке: поиск в узле - подсчёт без ветвлений
+    static constexpr bool natural_keys = std::is_integral_v<K> &&
+        (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+    //! Узлы можно не разрушать по одному: пулы отдаются целиком
+    static constexpr bool trivial_nodes = std::is_trivially_destructible_v<K> && std::is_trivially_destructible_v<V>;
+    //! Тип, которым ключ передаётся во внутренние спуски
+    using KeyArg = std::conditional_t<std::is_trivially_copyable_v<K> && sizeof(K) <= sizeof(void *),
+                                      K, const K &>;
+
+public:
+    //! Элементов в листе: заголовок листа - четыре слова, остальное - ключи и значения
+    static constexpr size_t leaf_capacity = (NodeBytes - 4 * sizeof(void *)) / (sizeof(K) + sizeof(V));
+    //! Разделителей во внутреннем узле: заголовок - два слова, потомков на один больше разделителей
+    static constexpr size_t inner_capacity = (NodeBytes - 3 * sizeof(void *)) / (sizeof(K) + sizeof(void *));
+    static_assert(leaf_capacity >= 4 && inner_capacity >= 4, "node is too small for the key and value types");
+
+private:
+    struct Inner;
+
+    //! Общее начало листа и внутреннего узла
+    struct NodeBase
+    {
+        Inner *parent = nullptr; //!< родительский узел, nullptr у корня
+        uint32_t count = 0;      //!< элементов в листе или разделителей во внутреннем узле
+    };
+
+    struct alignas(64) Leaf : NodeBase
+    {
+        Leaf *prev = nullptr; //!< предыдущий лист по возрастанию ключа
+        Leaf *next = nullptr; //!< следующий лист по возрастанию ключа
+        K keys[leaf_capacity];
+        V values[leaf_capacity];
+    };
+
+    struct alignas(64) Inner : NodeBase
+    {
+        K keys[inner_capacity];                 //!< разделители потомков
+        NodeBase *children[inner_capacity + 1]; //!< потомки, листья на нижнем уровне
+    };
+
+    static_assert(sizeof(Leaf) <= NodeBytes && sizeof(Inner) <= NodeBytes, "node does not fit into NodeBytes");
+
+    //! \brief Итератор по элементам листов в порядке возрастания ключа
+    //! \note Конец - нулевой лист; шаг назад от конца переходит к последнему листу дерева
+    template <bool Const>
+    class LeafIterator
+    {
+        using LeafPtr = std::conditional_t<Const, const Leaf *, Leaf *>;
+        using Mapped = std::conditional_t<Const, const V, V>;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const K &, Mapped &>;
+
+        //! Результат operator->: держит пару ссылок, чтобы it->first / it->second работали как у пары
+        struct pointer
+        {
+            reference ref;
+            const reference *operator->() const { return &ref; }
+        };
+
+        LeafIterator() = default;
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        LeafIterator &operator++();
+        LeafIterator operator++(int);
+
+        LeafIterator &operator--();
+        LeafIterator operator--(int);
+
+        bool operator==(const LeafIterator &other) const;
+        bool operator!=(const LeafIterator &other) const;
+
+    private:
+        friend class BasicBPlusTree;
+        LeafIterator(LeafPtr leaf, uint32_t pos, const BasicBPlusTree *tree);
+
+        LeafPtr _leaf = nullptr;                 //!< текущий лист, nullptr - конец
+        uint32_t _pos = 0;                       //!< позиция элемента в листе
+        const BasicBPlusTree *_tree = nullptr;   //!< дерево, для шага назад от конца
+    };
+
+public:
+    using Iterator = LeafIterator<false>;
+    using ConstIterator = LeafIterator<true>;
+
+    //! Конструктор по умолчанию
+    BasicBPlusTree() = default;
+    //! Конструктор с заданным режимом ключей и порядком ключей
+    explicit BasicBPlusTree(KeyMode mode, const Compare &compare = Compare());
+    //! \brief Конструктор копирования
+    //! \note Копия собирается из листов источника за O(n) сразу с заполненными узлами
+    explicit BasicBPlusTree(const BasicBPlusTree &other);
+    //! Оператор присваивания копированием
+    BasicBPlusTree &operator=(const BasicBPlusTree &other);
+    //! Конструктор перемещения
+    explicit BasicBPlusTree(BasicBPlusTree &&other) noexcept;
+    //! Оператор присваивания перемещением
+    BasicBPlusTree &operator=(BasicBPlusTree &&other) noexcept;
+    //! Деструктор
+    ~BasicBPlusTree();
+
+    //! Удалить все элементы дерева
+    void clear();
+
+    //! \brief Вставить элемент с ключем key и значением value
+    //! \note В режиме Unique значение существующего ключа заменяется,
+    //! в режиме Multi элемент встаёт после всех повторов ключа
+    void insert(const K &key, const V &value);
+    //! Удалить все элементы с ключем key
+    void erase(const K &key);
+
+    //! Найти первый элемент в дереве, равный ключу key
+    ConstIterator find(const K &key) const;
+    //! Найти первый элемент в дереве, равный ключу key
+    Iterator find(const K &key);
+
+    //! \brief Все элементы с ключем key: [first, second) - от первого равного key до первого большего
+    std::pair<Iterator, Iterator> equalRange(const K &key);
+    std::pair<ConstIterator, ConstIterator> equalRange(const K &key) const;
+
+    //! Итератор на первый элемент с ключем не меньше key или end()
+    Iterator lower_bound(const K &key);
+    ConstIterator lower_bound(const K &key) const;
+    //! Итератор на первый элемент с ключем больше key или end()
+    Iterator upper_bound(const K &key);
+    ConstIterator upper_bound(const K &key) const;
+
+    //! Получить итератор на элемент с наименьшим ключем в дереве
+    ConstIterator min() const;
+    //! Получить итератор на элемент с наибольшим ключем в дереве
+    ConstIterator max() const;
+    //! Получить итератор на элемент с ключем key с наименьшим значением
+    ConstIterator min(const K &key) const;
+    //! Получить итератор на элемент с ключем key с наибольшим значением
+    ConstIterator max(const K &key) const;
+
+    //! Получить итератор на первый элемент дерева (элемент с наименьшим key)
+    Iterator begin();
+    //! Получить итератор на элемент, следующий за последним элементом дерева
+    Iterator end();
+    //! Получить константный итератор на начало
+    ConstIterator cbegin() const;
+    //! Получить константный итератор на конец
+    ConstIterator cend() const;
+
+    //! Получить размер дерева
+    size_t size() const;
+    //! Узлов на пути от корня до листа (у B+дерева все листья на одной глубине)
+    size_t max_height() const;
+    //! Сколько байт занимают блоки пулов листьев и внутренних узлов
+    size_t bytes_reserved() const;
+    //! Получить режим ключей дерева
+    KeyMode key_mode() const;
+
+private:
+    bool less(KeyArg a, KeyArg b) const;
+    bool equal(KeyArg a, KeyArg b) const;
+    //! Сколько ключей из keys[0, count) меньше key
+    uint32_t count_less(const K *keys, uint32_t count, KeyArg key) const;
+    //! Сколько ключей из keys[0, count) не больше key
+    uint32_t count_not_greater(const K *keys, uint32_t count, KeyArg key) const;
+
+    Leaf *create_leaf();
+    Inner *create_inner();
+    void destroy_leaf(Leaf *leaf);
+    void destroy_inner(Inner *node);
+    //! Разрушить узлы поддерева, не возвращая память в пулы
+    void destroy_subtree(NodeBase *node, size_t level);
+
+    //! \brief Спуск к листу, в котором может лежать key
+    //! \param inclusive спускаться правее разделителей, равных key (иначе - левее)
+    Leaf *descend(KeyArg key, bool inclusive) const;
+    //! Лист и позиция первого элемента с ключем не меньше key, nullptr - конец
+    Leaf *lower_bound_leaf(KeyArg key, uint32_t &pos) const;
+    //! Лист и позиция первого элемента с ключем больше key, nullptr - конец
+    Leaf *upper_bound_leaf(KeyArg key, uint32_t &pos) const;
+
+    //! Номер потомка child в узле parent
+    static uint32_t child_index(const Inner *parent, const NodeBase *child);
+    //! Разрезать полный лист пополам, правая половина - новый лист после него
+    Leaf *split_leaf(Leaf *leaf);
+    //! Поставить в родителя left разделитель separator и нового правого соседа right
+    void insert_into_parent(NodeBase *left, const K &separator, NodeBase *right);
+    //! Удалить count элементов листа с позиции pos и восстановить заполнение листа
+    void erase_at(Leaf *leaf, uint32_t pos, uint32_t count);
+    //! Удалить потомка с номером at (не первого) и разделитель перед ним
+    void remove_child(Inner *node, uint32_t at);
+    //! Восстановить заполнение внутреннего узла: занять у соседа или слиться с ним
+    void rebalance_inner(Inner *node);
+    //! \brief Собрать дерево из n элементов, идущих по возрастанию ключа, за O(n)
+    //! \note Дерево должно быть пустым; элементы раскладываются по листам поровну
+    template <typename InputIt>
+    void build_sorted(InputIt first, size_t n);
+
+    KeyMode _mode = KeyMode::Unique; //!< режим ключей
+    Compare _compare;                //!< порядок ключей
+    NodePool<Leaf> _leaves;          //!< пул листьев
+    NodePool<Inner> _inners;         //!< пул внутренних узлов
+    NodeBase *_root = nullptr;       //!< корень: лист, если _levels == 0
+    Leaf *_first = nullptr;          //!< лист с наименьшими ключами
+    Leaf *_last = nullptr;           //!< лист с наибольшими ключами
+    size_t _levels = 0;              //!< уровней внутренних узлов над листьями
+    size_t _size = 0;                //!< размер дерева
+};
+
+using BPlusTree = BasicBPlusTree<Key, Value>;
+
+// ---------------------------------------------------------------------------
+// Итератор
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::LeafIterator(LeafPtr leaf, uint32_t pos,
+                                                                          const BasicBPlusTree *tree)
+    : _leaf(leaf), _pos(pos), _tree(tree) {}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator*() const -> reference {
+    return reference(_leaf->keys[_pos], _leaf->values[_pos]);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator->() const -> pointer {
+    return pointer{**this};
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator++() -> LeafIterator & {
+    if (++_pos == _leaf->count) {
+        _leaf = _leaf->next;
+        _pos = 0;
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator++(int) -> LeafIterator {
+    LeafIterator previous = *this;
+    ++*this;
+    return previous;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator--() -> LeafIterator & {
+    if (!_leaf) {
+        _leaf = _tree->_last;
+        _pos = _leaf->count - 1;
+    } else if (_pos == 0) {
+        _leaf = _leaf->prev;
+        _pos = _leaf->count - 1;
+    } else {
+        --_pos;
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator--(int) -> LeafIterator {
+    LeafIterator previous = *this;
+    --*this;
+    return previous;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+bool BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator==(const LeafIterator &other) const {
+    return _leaf == other._leaf && _pos == other._pos;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <bool Const>
+bool BasicBPlusTree<K, V, Compare, NodeBytes>::LeafIterator<Const>::operator!=(const LeafIterator &other) const {
+    return !(*this == other);
+}
+
+// ---------------------------------------------------------------------------
+// Конструкторы и присваивание
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+BasicBPlusTree<K, V, Compare, NodeBytes>::BasicBPlusTree(KeyMode mode, const Compare &compare)
+    : _mode(mode), _compare(compare) {}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+BasicBPlusTree<K, V, Compare, NodeBytes>::BasicBPlusTree(const BasicBPlusTree &other)
+    : _mode(other._mode), _compare(other._compare) {
+    build_sorted(other.cbegin(), other._size);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::operator=(const BasicBPlusTree &other) -> BasicBPlusTree & {
+    if (this != &other) {
+        clear();
+        _mode = other._mode;
+        _compare = other._compare;
+        build_sorted(other.cbegin(), other._size);
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+BasicBPlusTree<K, V, Compare, NodeBytes>::BasicBPlusTree(BasicBPlusTree &&other) noexcept
+    : _mode(other._mode), _compare(std::move(other._compare)), _leaves(std::move(other._leaves)),
+      _inners(std::move(other._inners)), _root(other._root), _first(other._first), _last(other._last),
+      _levels(other._levels), _size(other._size) {
+    other._root = nullptr;
+    other._first = other._last = nullptr;
+    other._levels = other._size = 0;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::operator=(BasicBPlusTree &&other) noexcept -> BasicBPlusTree & {
+    if (this != &other) {
+        clear();
+        _mode = other._mode;
+        _compare = std::move(other._compare);
+        _leaves = std::move(other._leaves);
+        _inners = std::move(other._inners);
+        _root = other._root;
+        _first = other._first;
+        _last = other._last;
+        _levels = other._levels;
+        _size = other._size;
+        other._root = nullptr;
+        other._first = other._last = nullptr;
+        other._levels = other._size = 0;
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+BasicBPlusTree<K, V, Compare, NodeBytes>::~BasicBPlusTree() {
+    clear();
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::clear() {
+    if constexpr (!trivial_nodes) {
+        if (_root) destroy_subtree(_root, _levels);
+    }
+    _leaves.release();
+    _inners.release();
+    _root = nullptr;
+    _first = _last = nullptr;
+    _levels = 0;
+    _size = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Изменение
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::insert(const K &key, const V &value) {
+    if (!_root) {
+        Leaf *leaf = create_leaf();
+        leaf->keys[0] = key;
+        leaf->values[0] = value;
+        leaf->count = 1;
+        _root = _first = _last = leaf;
+        _size = 1;
+        return;
+    }
+    // Спуск правее равных разделителей: в режиме Unique ключ, равный разделителю,
+    // лежит справа от него, в режиме Multi новый повтор встаёт после старых
+    Leaf *leaf = descend(key, true);
+    uint32_t pos;
+    if (_mode == KeyMode::Unique) {
+        pos = count_less(leaf->keys, leaf->count, key);
+        if (pos < leaf->count && !less(key, leaf->keys[pos])) {
+            leaf->values[pos] = value;
+            return;
+        }
+    } else {
+        pos = count_not_greater(leaf->keys, leaf->count, key);
+    }
+    if (leaf->count == leaf_capacity) {
+        // Разделитель - первый ключ правой половины, он не меньше вставляемого,
+        // если тот остаётся слева
+        Leaf *right = split_leaf(leaf);
+        if (pos > leaf->count) {
+            pos -= leaf->count;
+            leaf = right;
+        }
+    }
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+    leaf->keys[pos] = key;
+    leaf->values[pos] = value;
+    ++leaf->count;
+    ++_size;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::erase(const K &key) {
+    if (!_root) return;
+    if (_mode == KeyMode::Unique) {
+        Leaf *leaf = descend(key, true);
+        uint32_t pos = count_less(leaf->keys, leaf->count, key);
+        if (pos < leaf->count && !less(key, leaf->keys[pos])) erase_at(leaf, pos, 1);
+        return;
+    }
+    // Повторы могут занимать несколько листов: за раз удаляется их отрезок в одном
+    // листе, после перестройки листов поиск повторяется
+    for (;;) {
+        uint32_t pos;
+        Leaf *leaf = lower_bound_leaf(key, pos);
+        if (!leaf || less(key, leaf->keys[pos])) return;
+        uint32_t end = pos + 1;
+        while (end < leaf->count && !less(key, leaf->keys[end])) ++end;
+        erase_at(leaf, pos, end - pos);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Поиск
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::find(const K &key) const -> ConstIterator {
+    uint32_t pos = 0;
+    const Leaf *leaf = lower_bound_leaf(key, pos);
+    if (!leaf || !equal(leaf->keys[pos], key)) return cend();
+    return ConstIterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::find(const K &key) -> Iterator {
+    uint32_t pos = 0;
+    Leaf *leaf = lower_bound_leaf(key, pos);
+    if (!leaf || !equal(leaf->keys[pos], key)) return end();
+    return Iterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::equalRange(const K &key) -> std::pair<Iterator, Iterator> {
+    Iterator first = lower_bound(key);
+    if (_mode == KeyMode::Multi) return {first, upper_bound(key)};
+    Iterator last = first;
+    if (first != end() && equal(first->first, key)) ++last;
+    return {first, last};
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::equalRange(const K &key) const
+    -> std::pair<ConstIterator, ConstIterator> {
+    ConstIterator first = lower_bound(key);
+    if (_mode == KeyMode::Multi) return {first, upper_bound(key)};
+    ConstIterator last = first;
+    if (first != cend() && equal(first->first, key)) ++last;
+    return {first, last};
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::lower_bound(const K &key) -> Iterator {
+    uint32_t pos = 0;
+    Leaf *leaf = lower_bound_leaf(key, pos);
+    return Iterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::lower_bound(const K &key) const -> ConstIterator {
+    uint32_t pos = 0;
+    const Leaf *leaf = lower_bound_leaf(key, pos);
+    return ConstIterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::upper_bound(const K &key) -> Iterator {
+    uint32_t pos = 0;
+    Leaf *leaf = upper_bound_leaf(key, pos);
+    return Iterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::upper_bound(const K &key) const -> ConstIterator {
+    uint32_t pos = 0;
+    const Leaf *leaf = upper_bound_leaf(key, pos);
+    return ConstIterator(leaf, pos, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::min() const -> ConstIterator {
+    return cbegin();
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::max() const -> ConstIterator {
+    if (!_last) return cend();
+    return ConstIterator(_last, _last->count - 1, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::min(const K &key) const -> ConstIterator {
+    auto [first, last] = equalRange(key);
+    if constexpr (bst_detail::has_less<V>::value) {
+        // Повторы идут в порядке вставки: наименьшее значение ищется среди всех
+        ConstIterator best = first;
+        for (ConstIterator it = first; it != last; ++it) {
+            if (it->second < best->second) best = it;
+        }
+        return first == last ? cend() : best;
+    } else {
+        return first == last ? cend() : first;
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::max(const K &key) const -> ConstIterator {
+    auto [first, last] = equalRange(key);
+    if (first == last) return cend();
+    if constexpr (bst_detail::has_less<V>::value) {
+        ConstIterator best = first;
+        for (ConstIterator it = first; it != last; ++it) {
+            if (best->second < it->second) best = it;
+        }
+        return best;
+    } else {
+        return --last;
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::begin() -> Iterator {
+    return Iterator(_first, 0, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::end() -> Iterator {
+    return Iterator(nullptr, 0, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::cbegin() const -> ConstIterator {
+    return ConstIterator(_first, 0, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::cend() const -> ConstIterator {
+    return ConstIterator(nullptr, 0, this);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+size_t BasicBPlusTree<K, V, Compare, NodeBytes>::size() const {
+    return _size;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+size_t BasicBPlusTree<K, V, Compare, NodeBytes>::max_height() const {
+    return _root ? _levels + 1 : 0;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+size_t BasicBPlusTree<K, V, Compare, NodeBytes>::bytes_reserved() const {
+    return _leaves.bytes_reserved() + _inners.bytes_reserved();
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+KeyMode BasicBPlusTree<K, V, Compare, NodeBytes>::key_mode() const {
+    return _mode;
+}
+
+// ---------------------------------------------------------------------------
+// Внутренние операции
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+bool BasicBPlusTree<K, V, Compare, NodeBytes>::less(KeyArg a, KeyArg b) const {
+    return _compare(a, b);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+bool BasicBPlusTree<K, V, Compare, NodeBytes>::equal(KeyArg a, KeyArg b) const {
+    if constexpr (natural_keys) {
+        return a == b;
+    } else {
+        return !_compare(a, b) && !_compare(b, a);
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+uint32_t BasicBPlusTree<K, V, Compare, NodeBytes>::count_less(const K *keys, uint32_t count, KeyArg key) const {
+    if constexpr (natural_keys) {
+        // Узел короткий: подсчёт по всему массиву без ветвлений дешевле двоичного
+        // поиска с непредсказуемыми переходами и векторизуется
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < count; ++i) result += keys[i] < key;
+        return result;
+    } else {
+        return uint32_t(std::lower_bound(keys, keys + count, key, _compare) - keys);
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+uint32_t BasicBPlusTree<K, V, Compare, NodeBytes>::count_not_greater(const K *keys, uint32_t count, KeyArg key) const {
+    if constexpr (natural_keys) {
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < count; ++i) result += keys[i] <= key;
+        return result;
+    } else {
+        return uint32_t(std::upper_bound(keys, keys + count, key, _compare) - keys);
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::create_leaf() -> Leaf * {
+    return new (_leaves.allocate()) Leaf;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::create_inner() -> Inner * {
+    return new (_inners.allocate()) Inner;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::destroy_leaf(Leaf *leaf) {
+    leaf->~Leaf();
+    _leaves.deallocate(leaf);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::destroy_inner(Inner *node) {
+    node->~Inner();
+    _inners.deallocate(node);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::destroy_subtree(NodeBase *node, size_t level) {
+    if (level == 0) {
+        static_cast<Leaf *>(node)->~Leaf();
+        return;
+    }
+    Inner *inner = static_cast<Inner *>(node);
+    for (uint32_t i = 0; i <= inner->count; ++i) destroy_subtree(inner->children[i], level - 1);
+    inner->~Inner();
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::descend(KeyArg key, bool inclusive) const -> Leaf * {
+    NodeBase *node = _root;
+    for (size_t level = _levels; level > 0; --level) {
+        const Inner *inner = static_cast<const Inner *>(node);
+        uint32_t at = inclusive ? count_not_greater(inner->keys, inner->count, key)
+                                : count_less(inner->keys, inner->count, key);
+        node = inner->children[at];
+        // Все линии следующего узла запрашиваются разом: их промахи перекрываются
+        for (size_t line = 0; line < NodeBytes; line += 64) {
+            __builtin_prefetch(reinterpret_cast<const char *>(node) + line);
+        }
+    }
+    return static_cast<Leaf *>(node);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::lower_bound_leaf(KeyArg key, uint32_t &pos) const -> Leaf * {
+    if (!_root) return nullptr;
+    // В режиме Unique ключи слева от разделителя строго меньше его, поэтому равный
+    // разделителю ключ ищется справа; повторы в режиме Multi могут лежать и слева
+    Leaf *leaf = descend(key, _mode == KeyMode::Unique);
+    pos = count_less(leaf->keys, leaf->count, key);
+    if (pos == leaf->count) {
+        leaf = leaf->next;
+        pos = 0;
+    }
+    return leaf;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::upper_bound_leaf(KeyArg key, uint32_t &pos) const -> Leaf * {
+    if (!_root) return nullptr;
+    Leaf *leaf = descend(key, true);
+    pos = count_not_greater(leaf->keys, leaf->count, key);
+    if (pos == leaf->count) {
+        leaf = leaf->next;
+        pos = 0;
+    }
+    return leaf;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+uint32_t BasicBPlusTree<K, V, Compare, NodeBytes>::child_index(const Inner *parent, const NodeBase *child) {
+    uint32_t at = 0;
+    while (parent->children[at] != child) ++at;
+    return at;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+auto BasicBPlusTree<K, V, Compare, NodeBytes>::split_leaf(Leaf *leaf) -> Leaf * {
+    const uint32_t keep = leaf_capacity / 2;
+    Leaf *right = create_leaf();
+    std::move(leaf->keys + keep, leaf->keys + leaf->count, right->keys);
+    std::move(leaf->values + keep, leaf->values + leaf->count, right->values);
+    right->count = leaf->count - keep;
+    leaf->count = keep;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) {
+        leaf->next->prev = right;
+    } else {
+        _last = right;
+    }
+    leaf->next = right;
+
+    insert_into_parent(leaf, right->keys[0], right);
+    return right;
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::insert_into_parent(NodeBase *left, const K &separator, NodeBase *right) {
+    Inner *parent = left->parent;
+    if (!parent) {
+        // Разрезан корень: дерево растёт на уровень вверх
+        Inner *root = create_inner();
+        root->keys[0] = separator;
+        root->children[0] = left;
+        root->children[1] = right;
+        root->count = 1;
+        left->parent = right->parent = root;
+        _root = root;
+        ++_levels;
+        return;
+    }
+
+    const uint32_t at = child_index(parent, left);
+    right->parent = parent;
+    if (parent->count < inner_capacity) {
+        std::move_backward(parent->keys + at, parent->keys + parent->count, parent->keys + parent->count + 1);
+        std::copy_backward(parent->children + at + 1, parent->children + parent->count + 1,
+                           parent->children + parent->count + 2);
+        parent->keys[at] = separator;
+        parent->children[at + 1] = right;
+        ++parent->count;
+        return;
+    }
+
+    // Полный узел: inner_capacity + 1 разделителей делятся пополам, средний уходит в родителя
+    K keys[inner_capacity + 1];
+    NodeBase *children[inner_capacity + 2];
+    std::move(parent->keys, parent->keys + at, keys);
+    keys[at] = separator;
+    std::move(parent->keys + at, parent->keys + inner_capacity, keys + at + 1);
+    std::copy(parent->children, parent->children + at + 1, children);
+    children[at + 1] = right;
+    std::copy(parent->children + at + 1, parent->children + inner_capacity + 1, children + at + 2);
+
+    const uint32_t keep = (inner_capacity + 1) / 2;
+    Inner *sibling = create_inner();
+    std::move(keys, keys + keep, parent->keys);
+    std::copy(children, children + keep + 1, parent->children);
+    parent->count = keep;
+    std::move(keys + keep + 1, keys + inner_capacity + 1, sibling->keys);
+    std::copy(children + keep + 1, children + inner_capacity + 2, sibling->children);
+    sibling->count = uint32_t(inner_capacity - keep);
+    for (uint32_t i = 0; i <= sibling->count; ++i) sibling->children[i]->parent = sibling;
+
+    insert_into_parent(parent, keys[keep], sibling);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::erase_at(Leaf *leaf, uint32_t pos, uint32_t count) {
+    std::move(leaf->keys + pos + count, leaf->keys + leaf->count, leaf->keys + pos);
+    std::move(leaf->values + pos + count, leaf->values + leaf->count, leaf->values + pos);
+    leaf->count -= count;
+    _size -= count;
+
+    Inner *parent = leaf->parent;
+    if (!parent) {
+        if (!leaf->count) {
+            destroy_leaf(leaf);
+            _root = nullptr;
+            _first = _last = nullptr;
+        }
+        return;
+    }
+    if (leaf->count >= leaf_capacity / 2) return;
+
+    // Пара соседних листьев одного родителя: у первого потомка сосед справа, у остальных - слева
+    const uint32_t at = child_index(parent, leaf);
+    const uint32_t separator = at ? at - 1 : 0;
+    Leaf *left = static_cast<Leaf *>(parent->children[separator]);
+    Leaf *right = static_cast<Leaf *>(parent->children[separator + 1]);
+    const uint32_t total = left->count + right->count;
+
+    if (total <= leaf_capacity) {
+        std::move(right->keys, right->keys + right->count, left->keys + left->count);
+        std::move(right->values, right->values + right->count, left->values + left->count);
+        left->count = total;
+        left->next = right->next;
+        if (right->next) {
+            right->next->prev = left;
+        } else {
+            _last = left;
+        }
+        destroy_leaf(right);
+        remove_child(parent, separator + 1);
+        return;
+    }
+
+    // Слить нельзя: элементы делятся между листами поровну (в режиме Multi
+    // удаляется сразу отрезок повторов, и одного элемента соседа может не хватить)
+    const uint32_t left_count = total / 2;
+    if (left->count > left_count) {
+        const uint32_t moved = left->count - left_count;
+        std::move_backward(right->keys, right->keys + right->count, right->keys + right->count + moved);
+        std::move_backward(right->values, right->values + right->count, right->values + right->count + moved);
+        std::move(left->keys + left_count, left->keys + left->count, right->keys);
+        std::move(left->values + left_count, left->values + left->count, right->values);
+        left->count = left_count;
+        right->count += moved;
+    } else {
+        const uint32_t moved = left_count - left->count;
+        std::move(right->keys, right->keys + moved, left->keys + left->count);
+        std::move(right->values, right->values + moved, left->values + left->count);
+        std::move(right->keys + moved, right->keys + right->count, right->keys);
+        std::move(right->values + moved, right->values + right->count, right->values);
+        left->count = left_count;
+        right->count -= moved;
+    }
+    parent->keys[separator] = right->keys[0];
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::remove_child(Inner *node, uint32_t at) {
+    std::move(node->keys + at, node->keys + node->count, node->keys + at - 1);
+    std::copy(node->children + at + 1, node->children + node->count + 1, node->children + at);
+    --node->count;
+    rebalance_inner(node);
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::rebalance_inner(Inner *node) {
+    Inner *parent = node->parent;
+    if (!parent) {
+        // У корня остался один потомок: дерево становится на уровень ниже
+        if (!node->count) {
+            _root = node->children[0];
+            _root->parent = nullptr;
+            destroy_inner(node);
+            --_levels;
+        }
+        return;
+    }
+    if (node->count >= inner_capacity / 2) return;
+
+    const uint32_t at = child_index(parent, node);
+    const uint32_t separator = at ? at - 1 : 0;
+    Inner *left = static_cast<Inner *>(parent->children[separator]);
+    Inner *right = static_cast<Inner *>(parent->children[separator + 1]);
+
+    if (left->count + 1 + right->count <= inner_capacity) {
+        // Слияние: разделитель родителя опускается между потомками left и right
+        left->keys[left->count] = std::move(parent->keys[separator]);
+        std::move(right->keys, right->keys + right->count, left->keys + left->count + 1);
+        std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+        for (uint32_t i = 0; i <= right->count; ++i) right->children[i]->parent = left;
+        left->count += 1 + right->count;
+        destroy_inner(right);
+        remove_child(parent, separator + 1);
+        return;
+    }
+
+    // Внутренний узел теряет по одному потомку, поэтому хватает одного потомка соседа:
+    // он переходит через разделитель родителя
+    if (node == right) {
+        std::move_backward(right->keys, right->keys + right->count, right->keys + right->count + 1);
+        std::copy_backward(right->children, right->children + right->count + 1, right->children + right->count + 2);
+        right->keys[0] = std::move(parent->keys[separator]);
+        right->children[0] = left->children[left->count];
+        right->children[0]->parent = right;
+        parent->keys[separator] = std::move(left->keys[left->count - 1]);
+        --left->count;
+        ++right->count;
+    } else {
+        left->keys[left->count] = std::move(parent->keys[separator]);
+        left->children[left->count + 1] = right->children[0];
+        left->children[left->count + 1]->parent = left;
+        parent->keys[separator] = std::move(right->keys[0]);
+        std::move(right->keys + 1, right->keys + right->count, right->keys);
+        std::copy(right->children + 1, right->children + right->count + 1, right->children);
+        ++left->count;
+        --right->count;
+    }
+}
+
+template <typename K, typename V, typename Compare, size_t NodeBytes>
+template <typename InputIt>
+void BasicBPlusTree<K, V, Compare, NodeBytes>::build_sorted(InputIt first, size_t n) {
+    if (!n) return;
+    // Узлы уровня вместе с наименьшим ключом своего поддерева - разделителем перед ним
+    std::vector<std::pair<NodeBase *, K>> level;
+    const size_t leaves = (n + leaf_capacity - 1) / leaf_capacity;
+    level.reserve(leaves);
+    Leaf *previous = nullptr;
+    for (size_t i = 0; i < leaves; ++i) {
+        const uint32_t take = uint32_t(n / leaves + (i < n % leaves));
+        Leaf *leaf = create_leaf();
+        for (uint32_t j = 0; j < take; ++j, ++first) {
+            leaf->keys[j] = first->first;
+            leaf->values[j] = first->second;
+        }
+        leaf->count = take;
+        leaf->prev = previous;
+        if (previous) {
+            previous->next = leaf;
+        } else {
+            _first = leaf;
+        }
+        previous = leaf;
+        level.emplace_back(leaf, leaf->keys[0]);
+    }
+    _last = previous;
+
+    while (level.size() > 1) {
+        const size_t nodes = (level.size() + inner_capacity) / (inner_capacity + 1);
+        std::vector<std::pair<NodeBase *, K>> upper;
+        upper.reserve(nodes);
+        size_t at = 0;
+        for (size_t i = 0; i < nodes; ++i) {
+            const uint32_t take = uint32_t(level.size() / nodes + (i < level.size() % nodes));
+            Inner *node = create_inner();
+            for (uint32_t j = 0; j < take; ++j) {
+                node->children[j] = level[at + j].first;
+                node->children[j]->parent = node;
+                if (j) node->keys[j - 1] = std::move(level[at + j].second);
+            }
+            node->count = take - 1;
+            upper.emplace_back(node, std::move(level[at].second));
+            at += take;
+        }
+        level.swap(upper);
+        ++_levels;
+    }
+    _root = level[0].first;
+    _size = n;
+}
@@ -1,19 +1,165 @@
 #pragma once
 
-#include <utility>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "FindCache.h"
+#include "NodePool.h"
+#include "ThreadPool.h"
+#include "TreeFile.h"
+#include "TreeStats.h"
+
+using Key = uint32_t; //!< тип ключей в BinarySearchTree
+using Value = double; //!< тип значений в BinarySearchTree
 
-using Key = uint32_t; //!< тип ключей в дереве
-using Value = double; //!< тип значений в дереве
+class FrozenIndex;
 
-//! Имплементация бинарного дерева поиска
+//! Цвет узла LLRB-дерева
 enum Color { RED, BLACK };
-class BinarySearchTree 
+
+/*!***********************************************************
+Режим ключей дерева:
+  - Unique - ключ встречается не больше одного раза, вставка
+    существующего ключа заменяет значение
+  - Multi - повторы ключа сохраняются, элементы с одинаковым
+    ключом упорядочены по значению (если значения сравнимы
+    оператором <, иначе - в порядке вставки), поэтому
+    min(key) / max(key) и equalRange находятся одним спуском
+**************************************************************/
+enum class KeyMode { Unique, Multi };
+
+namespace bst_detail {
+
+//! Сравнимы ли значения типа T оператором <
+template <typename T, typename = void>
+struct has_less : std::false_type {};
+
+template <typename T>
+struct has_less<T, std::void_t<decltype(std::declval<const T &>() < std::declval<const T &>())>>
+    : std::true_type {};
+
+//! Есть ли для T специализация std::hash
+template <typename T, typename = void>
+struct is_hashable : std::false_type {};
+
+template <typename T>
+struct is_hashable<T, std::void_t<decltype(std::hash<T>()(std::declval<const T &>()))>> : std::true_type {};
+
+//! Пустой агрегат для неарифметических значений
+struct NoAggregate {};
+
+//! Пишутся ли значения типа T через std::to_chars / читаются через std::from_chars
+template <typename T>
+constexpr bool is_text_field = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+//! Пропустить пробелы и табуляции
+inline const char *skip_blanks(const char *first, const char *last) {
+    while (first != last && (*first == ' ' || *first == '\t')) ++first;
+    return first;
+}
+
+//! \brief Разобрать строку "key,value" без перевода строки; false - строка не разобрана
+//! \note Пробелы вокруг полей и завершающий '\r' допускаются
+template <typename K, typename V>
+bool parse_text_line(const char *first, const char *last, K &key, V &value) {
+    if (first != last && last[-1] == '\r') --last;
+    auto parsed = std::from_chars(skip_blanks(first, last), last, key);
+    const char *pos = skip_blanks(parsed.ptr, last);
+    if (parsed.ec != std::errc() || pos == last || *pos != ',') return false;
+    parsed = std::from_chars(skip_blanks(pos + 1, last), last, value);
+    return parsed.ec == std::errc() && skip_blanks(parsed.ptr, last) == last;
+}
+
+} // namespace bst_detail
+
+#ifdef BST_RANGE_AGGREGATES
+//! Сумма, минимум и максимум значений; у пустого набора min = +inf, max = -inf
+template <typename V>
+struct BasicRangeAggregate
 {
+    V sum = 0;
+    V min = std::numeric_limits<V>::has_infinity ? std::numeric_limits<V>::infinity()
+                                                 : std::numeric_limits<V>::max();
+    V max = std::numeric_limits<V>::has_infinity ? -std::numeric_limits<V>::infinity()
+                                                 : std::numeric_limits<V>::lowest();
+
+    //! Учесть одно значение
+    void add(const V &value) {
+        sum += value;
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    //! Учесть агрегат другого набора
+    void merge(const BasicRangeAggregate &other) {
+        sum += other.sum;
+        if (other.min < min) min = other.min;
+        if (other.max > max) max = other.max;
+    }
+};
+
+using RangeAggregate = BasicRangeAggregate<Value>;
+#endif
+
+/*!***********************************************************
+Бинарное дерево поиска (левостороннее красно-чёрное) с типом
+ключа K, типом значения V, строгим порядком ключей Compare и
+аллокатором Alloc, из которого пул берёт блоки узлов. Дерево
+целиком в заголовке; ветви, зависящие от типов, выбираются при
+компиляции:
+  - целочисленные ключи с std::less сравниваются на равенство
+    одним ==, а не двумя вызовами Compare
+  - ключи, которые дёшево копировать, передаются во внутренние
+    спуски по значению
+  - если узлы тривиально разрушаемы, clear() и деструктор отдают
+    пул целиком, не обходя дерево
+  - повторы ключа в режиме Multi упорядочиваются по значению,
+    только если значения сравнимы оператором <
+Псевдоним BinarySearchTree - дерево с ключами Key и значениями Value.
+**************************************************************/
+template <typename K, typename V, typename Compare = std::less<K>,
+          typename Alloc = std::allocator<std::pair<const K, V>>>
+class BasicBinarySearchTree
+{
+    //! Целые ключи в естественном порядке: равенство проверяется одним ==
+    static constexpr bool natural_keys = std::is_integral_v<K> &&
+        (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+    //! Повторы ключа упорядочиваются по значению
+    static constexpr bool ordered_values = bst_detail::has_less<V>::value;
+#ifdef BST_RANGE_AGGREGATES
+    //! Агрегаты ведутся только для арифметических значений
+    static constexpr bool aggregated = std::is_arithmetic_v<V>;
+    using Aggregate = std::conditional_t<aggregated, BasicRangeAggregate<V>, bst_detail::NoAggregate>;
+#endif
+#ifdef BST_FIND_CACHE
+    //! Кэш поиска ведётся для ключей с std::hash
+    static constexpr bool cached_keys = bst_detail::is_hashable<K>::value;
+#endif
+    //! Тип, которым ключ передаётся во внутренние спуски
+    using KeyArg = std::conditional_t<std::is_trivially_copyable_v<K> && sizeof(K) <= sizeof(void *),
+                                      K, const K &>;
+
+    struct Node;
+    //! Аллокатор пула узлов
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+
     struct Node 
     {
-        Node(Key key, Value value, 
+        Node(const K &key, const V &value, 
              Node *parent = nullptr, Node *left = nullptr, 
              Node *right = nullptr, Color color = RED);
 
@@ -24,45 +170,67 @@ class BinarySearchTree
         //! Вывод в консоль поддерева, где текущий узел - корень
         void output_node_tree() const;
         //! Вставить новый узел в поддерево, где текущий узел - корень
-        void insert(const Key &key, const Value &value);
+        void insert(const K &key, const V &value);
         //! Удалить узел из поддерева, где текущий узел - корень
-        void erase(const Key &key);
+        void erase(const K &key);
 
-        std::pair<Key, Value> keyValuePair; //!< Пара ключ - значение
+        std::pair<K, V> keyValuePair; //!< Пара ключ - значение
         Node *parent = nullptr; //!< родительский узел
         Node *left = nullptr;   //!< левый потомок
         Node *right = nullptr;  //!< правый потомок
         Color color;
+#ifdef BST_ORDER_STATISTICS
+        //! Число узлов в поддереве, включая этот (занимает выравнивание после color)
+        uint32_t count = 1;
+#endif
+#ifdef BST_RANGE_AGGREGATES
+        Aggregate aggregate; //!< сумма, минимум и максимум значений поддерева
+#endif
+#ifdef BST_THREADED
+        Node *prev = nullptr; //!< предыдущий узел по возрастанию ключа
+        Node *next = nullptr; //!< следующий узел по возрастанию ключа
+#endif
     };
 public:
     //! Конструктор по умолчанию
-    BinarySearchTree() = default;
+    BasicBinarySearchTree() = default;
+    //! Конструктор с заданным размером первого блока пула узлов
+    explicit BasicBinarySearchTree(size_t nodes_per_slab);
+    //! Конструктор с заданным режимом ключей, порядком ключей и аллокатором
+    explicit BasicBinarySearchTree(KeyMode mode, size_t nodes_per_slab = 64,
+                                   const Compare &compare = Compare(), const Alloc &alloc = Alloc());
+    //! \brief Построить дерево из последовательности пар ключ - значение за O(n)
+    //! \note Последовательность должна быть отсортирована, см. build_from_sorted
+    template <typename InputIt>
+    BasicBinarySearchTree(InputIt first, InputIt last, KeyMode mode = KeyMode::Unique);
     //! Конструктор копирования
-    explicit BinarySearchTree(const BinarySearchTree &other);
+    explicit BasicBinarySearchTree(const BasicBinarySearchTree &other);
     //! Оператор присваивания копированием
-    BinarySearchTree &operator=(const BinarySearchTree &other);
+    BasicBinarySearchTree &operator=(const BasicBinarySearchTree &other);
     //! Конструктор перемещения
-    explicit BinarySearchTree(BinarySearchTree &&other) noexcept;
+    explicit BasicBinarySearchTree(BasicBinarySearchTree &&other) noexcept;
     //! Оператор присваивания перемещением
-    BinarySearchTree &operator=(BinarySearchTree &&other) noexcept;
+    BasicBinarySearchTree &operator=(BasicBinarySearchTree &&other) noexcept;
     //! Деструктор
     void delete_subtree(Node* node);
-    ~BinarySearchTree();
+    ~BasicBinarySearchTree();
 
     size_t compute_height(Node *n) const;
 
     //! \brief Итератор бинарного дерева поиска
-    //! \note Обходит дерево последовательно от узла с меньшим ключом к узлу с большим 
+    //! \note Обходит дерево последовательно от узла с меньшим ключом к узлу с большим.
+    //! При сборке с BST_THREADED каждый узел хранит соседей prev / next, и шаг
+    //! итератора - один переход по ссылке вместо подъёма по parent
     class Iterator 
     {
     public:
         explicit Iterator(Node *node);
 
-        std::pair<Key, Value> &operator*();
-        const std::pair<Key, Value> &operator*() const;
+        std::pair<K, V> &operator*();
+        const std::pair<K, V> &operator*() const;
 
-        std::pair<Key, Value> *operator->();
-        const std::pair<Key, Value> *operator->() const;
+        std::pair<K, V> *operator->();
+        const std::pair<K, V> *operator->() const;
 
         Iterator operator++();
         Iterator operator++(int);
@@ -83,8 +251,8 @@ public:
     public:
         explicit ConstIterator(const Node *node);
 
-        const std::pair<Key, Value> &operator*() const;
-        const std::pair<Key, Value> *operator->() const;
+        const std::pair<K, V> &operator*() const;
+        const std::pair<K, V> *operator->() const;
 
         ConstIterator operator++();
         ConstIterator operator++(int);
@@ -99,14 +267,142 @@ public:
         const Node *_node;
     };
 
-    //! Вставить элемент с ключем key и значением value
-    void insert(const Key &key, const Value &value);
+    //! Граница глубины дерева: высота LLRB-дерева не больше 2 log2(n)
+    static constexpr size_t max_scan_depth = 2 * 64;
+
+    /*!***********************************************************
+    Итератор просмотра диапазона (см. range): вместо подъёма по
+    parent хранит стек узлов, левые поддеревья которых сейчас
+    обходятся, поэтому следующий узел - либо вершина стека, либо
+    самый левый узел правого поддерева текущего. Кладя узел в стек,
+    итератор заранее подгружает его правого потомка: к нему обход
+    придёт только после всего левого поддерева, и ожидание памяти
+    успевает перекрыться обходом.
+
+    Итератор занимает около килобайта (стек на max_scan_depth
+    узлов), копировать его лучше не в цикле.
+    **************************************************************/
+    class ScanIterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type *;
+        using reference = const value_type &;
+
+        //! Итератор конца диапазона
+        ScanIterator() = default;
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        ScanIterator &operator++();
+        ScanIterator operator++(int);
+
+        bool operator==(const ScanIterator &other) const;
+        bool operator!=(const ScanIterator &other) const;
+
+    private:
+        friend class BasicBinarySearchTree;
+
+        void push_left(const Node *node);
+        void pop();
+
+        const BasicBinarySearchTree *_tree = nullptr;
+        const Node *_node = nullptr;   //!< текущий узел, nullptr - конец
+        bool _bounded = false;         //!< есть ли верхняя граница _hi
+        K _hi{};                       //!< ключи не меньше _hi за диапазоном
+        size_t _depth = 0;             //!< узлов в стеке
+        std::array<const Node*, max_scan_depth> _stack; //!< узлы, к которым обход вернётся
+    };
+
+    //! \brief Диапазон элементов с ключами из [lo, hi) для range-for, см. range
+    //! \note Вид не копирует элементы и становится недействительным после изменения дерева
+    class RangeView
+    {
+    public:
+        ScanIterator begin() const;
+        ScanIterator end() const;
+        bool empty() const;
+
+    private:
+        friend class BasicBinarySearchTree;
+        RangeView(const BasicBinarySearchTree *tree, const K &lo, const K &hi);
+
+        const BasicBinarySearchTree *_tree;
+        K _lo;
+        K _hi;
+    };
+
+    //! \brief Заменить содержимое дерева парами из [first, last) за O(n)
+    //! \note Последовательность должна быть отсортирована по ключу, а в режиме
+    //! Multi - по паре ключ - значение. В режиме Unique из повторов ключа остаётся
+    //! последний. Дерево собирается сразу сбалансированным, без вставок и поворотов
+    template <typename InputIt>
+    void build_from_sorted(InputIt first, InputIt last);
+    //! Удалить все элементы дерева
+    void clear();
+
+    //! \brief Вставить элемент с ключем key и значением value
+    //! \note В режиме Unique значение существующего ключа заменяется
+    void insert(const K &key, const V &value);
     //! Удалить все элементы с ключем key
-    void erase(const Key &key);
+    void erase(const K &key);
+    /*!***********************************************************
+    Вставить пачку элементов. Пачка сортируется по ключу, в режиме
+    Unique при повторе ключа остаётся последнее значение, как при
+    вставке по одному:
+      - небольшая пачка вставляется по возрастанию ключей, и каждый
+        спуск начинается не от корня, а от предыдущего вставленного
+        узла
+      - большая пачка сливается с деревом за O(n + m), и дерево
+        собирается заново из тех же узлов
+    **************************************************************/
+    void insert_batch(std::vector<std::pair<K, V>> batch);
+    //! Удалить элементы со всеми ключами из пачки
+    //! \note Большая пачка удаляется одним проходом с пересборкой дерева
+    void erase_batch(std::vector<K> keys);
+
+    /*!***********************************************************
+    Операции над двумя деревьями на основе join: дерево other
+    забирается целиком и после операции пусто. При равных
+    аллокаторах блоки узлов other переходят в пул этого дерева без
+    копирования, иначе узлы other сначала копируются в пул этого
+    дерева за O(m). Деревья должны иметь один режим ключей и
+    порядок.
+      - join(L, k, R) подвешивает меньшее по чёрной высоте дерево
+        на край большего и чинит путь обычными поворотами, O(log n)
+      - split разрезает дерево по ключу цепочкой join, O(log^2 n)
+      - unite / intersect / difference раскладывают other по
+        корню, режут этим ключом дерево и рекурсивно обрабатывают
+        левые и правые части; две половины выполняются параллельно
+        в ThreadPool::shared(), O(m log(n/m + 1)) работы
+    **************************************************************/
+    //! \brief Дописать дерево other, все элементы которого идут после элементов дерева
+    //! \note Если это не так, выполняется unite
+    void join(BasicBinarySearchTree &&other);
+    //! \brief Отделить элементы с ключами не меньше key в новое дерево
+    //! \note Разрез - O(log^2 n), но отделённые элементы переносятся в пул нового
+    //! дерева по одному, поэтому всего O(log^2 n + k) для k отделённых
+    BasicBinarySearchTree split(const K &key);
+    //! \brief Объединение: добавить элементы other
+    //! \note В режиме Unique при совпадении ключей остаётся значение из other,
+    //! в режиме Multi сохраняются все элементы обоих деревьев
+    void unite(BasicBinarySearchTree &&other);
+    //! Пересечение: оставить элементы, ключи которых есть в other
+    void intersect(BasicBinarySearchTree &&other);
+    //! Разность: удалить элементы, ключи которых есть в other
+    void difference(BasicBinarySearchTree &&other);
+
     //! Найти первый элемент в дереве, равный ключу key
-    ConstIterator find(const Key &key) const;
+    ConstIterator find(const K &key) const;
     //! Найти первый элемент в дереве, равный ключу key
-    Iterator find(const Key &key);
+    Iterator find(const K &key);
+    //! \brief Найти count ключей разом: out[i] - значение для keys[i], found[i] - нашёлся ли ключ
+    //! \note Спуски идут пачками в ногу, следующий узел каждого спуска подгружается заранее,
+    //! поэтому ожидания памяти разных спусков перекрываются
+    void find_many(const K *keys, size_t count, V *out, bool *found) const;
 
     /*!***********************************************************
     Найти все элементы, у которых ключ равен key:
@@ -116,17 +412,51 @@ public:
     [pair.first, pair.second) - полуинтервал, содержащий все 
     элементы с ключем key
     **************************************************************/
-    std::pair<Iterator, Iterator> equalRange(const Key &key);
-    std::pair<ConstIterator, ConstIterator> equalRange(const Key &key) const;
+    std::pair<Iterator, Iterator> equalRange(const K &key);
+    std::pair<ConstIterator, ConstIterator> equalRange(const K &key) const;
+
+    //! Итератор на первый элемент с ключем не меньше key или end()
+    Iterator lower_bound(const K &key);
+    ConstIterator lower_bound(const K &key) const;
+    //! Итератор на первый элемент с ключем больше key или end()
+    Iterator upper_bound(const K &key);
+    ConstIterator upper_bound(const K &key) const;
+    //! \brief Все элементы с ключами из [lo, hi) по возрастанию ключа:
+    //! for (const auto &[key, value] : tree.range(lo, hi)) ...
+    //! \note Начало находится одним спуском, дальше обход идёт итератором ScanIterator
+    RangeView range(const K &lo, const K &hi) const;
     
     //! Получить итератор на элемент с наименьшим ключем в дереве
     ConstIterator min() const;
     //! Получить итератор на элемент с наибольшим ключем в дереве
     ConstIterator max() const;
     //! Получить итератор на элемент с ключем key с наименьшим значением 
-    ConstIterator min(const Key &key) const;
+    ConstIterator min(const K &key) const;
     //! Получить итератор на элемент с ключем key с наибольшим значением
-    ConstIterator max(const Key &key) const;
+    ConstIterator max(const K &key) const;
+
+#ifdef BST_ORDER_STATISTICS
+    /*!***********************************************************
+    Порядковые статистики, доступны при сборке с
+    BST_ORDER_STATISTICS: каждый узел хранит размер своего
+    поддерева, поэтому запросы выполняются одним спуском за
+    O(log n) без обхода итератором.
+    **************************************************************/
+    //! Количество элементов с ключем меньше key
+    size_t rank(const K &key) const;
+    //! Элемент с номером k по возрастанию ключа (с нуля) или cend(), если k >= size()
+    ConstIterator select(size_t k) const;
+    //! Количество элементов с ключами из [lo, hi)
+    size_t count_range(const K &lo, const K &hi) const;
+#endif
+
+#ifdef BST_RANGE_AGGREGATES
+    //! \brief Сумма, минимум и максимум значений элементов с ключами из [lo, hi) за O(log n)
+    //! \note Доступно при сборке с BST_RANGE_AGGREGATES. Каждый узел хранит агрегат
+    //! своего поддерева, поэтому значения нужно менять через insert: запись через
+    //! Iterator агрегаты не обновляет
+    Aggregate range_aggregate(const K &lo, const K &hi) const;
+#endif
 
     //! Получить итератор на первый элемент дерева (элемент с наименьшим key)
     Iterator begin();
@@ -139,24 +469,2297 @@ public:
     //! Получить константный итератор на конец
     ConstIterator cend() const;
 
+    //! \brief Снять неизменяемый индекс для быстрого поиска, см. FrozenIndex
+    //! \note Индекс не связан с деревом и не видит его последующих изменений.
+    //! FrozenIndex строится только из BinarySearchTree
+    template <typename Index = FrozenIndex>
+    Index freeze() const;
+
+    /*!***********************************************************
+    Сохранить дерево в двоичный файл (формат см. TreeFile.h):
+    ключи и значения пишутся массивами по возрастанию ключа через
+    отображение файла в память. Запись идёт во временный файл
+    path + ".tmp", который затем атомарно заменяет path. Ключи и
+    значения должны быть тривиально копируемыми.
+    **************************************************************/
+    void save(const std::string &path) const;
+    //! \brief Заменить содержимое дерева содержимым файла, записанного save, за O(n)
+    //! \note Проверяются заголовок, контрольная сумма и порядок ключей, режим ключей
+    //! берётся из файла. Ошибки бросаются как std::runtime_error / std::system_error
+    void load(const std::string &path);
+
+    /*!***********************************************************
+    Выгрузить элементы по возрастанию ключа строками "key,value".
+    Числа форматируются std::to_chars (кратчайшая запись, которая
+    читается обратно без потерь) в буфер, а в поток уходят блоками
+    по 64 КБ без сброса после каждой строки.
+    **************************************************************/
+    void export_text(std::ostream &out) const;
+    /*!***********************************************************
+    Добавить в дерево элементы из строк "key,value" (как insert
+    по одному в порядке строк) и вернуть количество строк с
+    элементами. Поток читается блоками по 1 МБ, числа разбираются
+    std::from_chars, пустые строки пропускаются:
+      - пока дерево было пустым и строки идут по возрастанию,
+        узлы собираются в дерево сразу, как в build_from_sorted
+      - после первой строки не по порядку остальные строки
+        вставляются пачками через insert_batch
+    При ошибке разбора в дереве остаются строки до неё, а ошибка
+    бросается как std::runtime_error с номером строки.
+    **************************************************************/
+    size_t import_text(std::istream &in);
+
     //! Получить размер дерева
     size_t size() const;
     //! Вывести дерево в консоль
     void output_tree();
 	//! Получить максимальную высоту в дереве
 	size_t max_height() const;
+    //! Сколько байт занимают блоки пула узлов
+    size_t bytes_reserved() const;
+    //! Аллокатор, из которого берутся блоки пула узлов
+    Alloc get_allocator() const;
+#ifdef BST_FIND_CACHE
+    //! Попадания и промахи кэша поиска, см. FindCache.h
+    FindCacheStats find_cache_stats() const;
+    //! Обнулить счётчики кэша поиска
+    void reset_find_cache_stats();
+#endif
+#ifdef BST_STATS
+    //! \brief Снимок счётчиков и формы дерева, см. TreeStats.h
+    //! \note Счётчики принадлежат экземпляру и не переносятся при копировании и перемещении
+    TreeStats stats() const;
+    //! Обнулить счётчики
+    void reset_stats();
+#endif
+    //! Получить режим ключей дерева
+    KeyMode key_mode() const;
 
 private:
+    //! Оптимистичный поиск спускается по узлам сам, см. OptimisticTree.h
+    template <typename, typename, typename> friend class BasicOptimisticTree;
+
+    KeyMode _mode = KeyMode::Unique; //!< режим ключей
     size_t _size = 0; //!< размер дерева
     Node *_root = nullptr; //!< корневой узел дерева
+#ifdef BST_THREADED
+    Node *_first = nullptr; //!< узел с наименьшим ключем
+    Node *_last = nullptr;  //!< узел с наибольшим ключем
+#endif
+    Compare _compare; //!< порядок ключей
+#ifdef BST_STATS
+    mutable bst_detail::StatCounters _stats; //!< счётчики для stats()
+#endif
+#ifdef BST_FIND_CACHE
+    mutable FindCache<Node> _find_cache; //!< узлы недавно найденных ключей
+#endif
+    NodePool<Node, NodeAlloc> _pool; //!< пул, из которого выделяются узлы
+    bool less(KeyArg a, KeyArg b) const;
+    bool equal(KeyArg a, KeyArg b) const;
+    Node* create_node(const K& key, const V& value, Node *parent);
+    void destroy_node(Node *node);
     bool isRed(Node* node) const;
     Node* rotate_left(Node* node);
     Node* rotate_right(Node* node);
+    void pull(Node *h);
+    void pull_path(Node *h);
+    void thread_leaf(Node *node);
+    void unthread(Node *node);
+    void thread_seams(Node *l, Node *k, Node *r);
+    void thread_ends();
+    void note_search(size_t depth, size_t comparisons) const;
+    Node* cached_node(KeyArg key) const;
+    void cache_node(KeyArg key, Node *node) const;
+    void uncache(const Node *node);
+    void flush_find_cache();
     void flip_colors(Node *h);
     Node* move_red_left(Node *h);
     Node* move_red_right(Node *h);
     Node* fix_up(Node *h);
     Node* min_node(Node *h);
-    Node* insert_rb(Node* h, const Key& key, const Value& value, Node *parent);
-    Node* erase_rb(Node *h, const Key &key);
+    Node** link_of(Node *h);
+    Node* insert_rb(const K& key, const V& value, Node *start = nullptr);
+    void fix_insert(Node *h);
+    void erase_rb(const K &key);
+    static size_t sorted_capacity(size_t count);
+    Node* link_sorted(Node **nodes, size_t count, size_t capacity, Node *parent);
+    void relink_sorted(std::vector<Node*> &nodes);
+    void collect_nodes(std::vector<Node*> &nodes, Node *root);
+    bool prefer_rebuild(size_t batch_size) const;
+    bool goes_left(const K &key, const V &value, const std::pair<K, V> &pair) const;
+    Node* find_node(KeyArg key) const;
+    bool has_key(KeyArg key) const;
+
+    //! Части дерева после split_nodes: до разреза, равные ключу разреза, после
+    struct Split
+    {
+        Node *left = nullptr;
+        Node *mid = nullptr;
+        Node *right = nullptr;
+    };
+    static Node* detach(Node *h);
+    static size_t black_height(const Node *h);
+    Node* join_right(Node *l, size_t lh, Node *k, Node *r, size_t rh);
+    Node* join_left(Node *l, size_t lh, Node *k, Node *r, size_t rh);
+    Node* join_nodes(Node *l, Node *k, Node *r);
+    Node* join2(Node *l, Node *r);
+    Node* split_last(Node *h, Node *&last);
+    template <typename Side>
+    Split split_nodes(Node *h, const Side &side);
+    Split split_by_key(Node *h, KeyArg key);
+    Node* unite_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage);
+    Node* intersect_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage);
+    Node* difference_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage);
+    static size_t fork_depth();
+    template <typename Left, typename Right>
+    void fork(size_t depth, Left &&left, Right &&right);
+
+    //! Непрерывный блок под узлы копии дерева, ветви копирования берут из него куски
+    struct CloneBlock
+    {
+        Node *nodes = nullptr;          //!< начало блока
+        size_t capacity = 0;            //!< узлов в блоке
+        size_t chunk = 0;               //!< узлов в одном куске
+        size_t fork_depth = 0;          //!< до какой глубины ветви копируются параллельно
+        std::atomic<size_t> taken{0};   //!< узлов блока, уже разобранных кусками
+    };
+    //! Кусок блока, из которого одна ветвь копирования берёт узлы подряд
+    struct CloneCursor
+    {
+        Node *next = nullptr;
+        Node *end = nullptr;
+    };
+    //! Копия поддерева: корень и узлы с наименьшим и наибольшим ключем
+    struct Cloned
+    {
+        Node *root = nullptr;
+        Node *first = nullptr;
+        Node *last = nullptr;
+    };
+    void clone_from(const BasicBinarySearchTree &other);
+    Cloned clone_nodes(const Node *h, size_t depth, CloneBlock &block, CloneCursor &cursor,
+                       std::vector<CloneCursor> &leftovers);
+    Node* absorb(BasicBinarySearchTree &other);
+    size_t destroy_detached(const std::vector<Node*> &roots);
+    ScanIterator scan(const K *lo, const K *hi) const;
+    Node* lower_bound_node(KeyArg key) const;
+    Node* upper_bound_node(KeyArg key) const;
 };
+
+//! Дерево с ключами Key и значениями Value
+using BinarySearchTree = BasicBinarySearchTree<Key, Value>;
+
+template <typename K, typename V, typename Compare, typename Alloc>
+template <typename InputIt>
+BasicBinarySearchTree<K, V, Compare, Alloc>::BasicBinarySearchTree(InputIt first, InputIt last, KeyMode mode) : _mode(mode) {
+    build_from_sorted(first, last);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+template <typename InputIt>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::build_from_sorted(InputIt first, InputIt last) {
+    clear();
+    std::vector<Node*> nodes;
+    for (; first != last; ++first) {
+        if (_mode == KeyMode::Unique && !nodes.empty() && equal(nodes.back()->keyValuePair.first, first->first)) {
+            nodes.back()->keyValuePair.second = first->second;
+            continue;
+        }
+        nodes.push_back(create_node(first->first, first->second, nullptr));
+    }
+    relink_sorted(nodes);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+template <typename Index>
+Index BasicBinarySearchTree<K, V, Compare, Alloc>::freeze() const {
+    return Index(*this);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::Node::Node(const K &key, const V &value, Node *parent, Node *left, Node *right, Color color) : keyValuePair{key, value}, parent(parent), left(left), right(right), color(color) {
+#ifdef BST_RANGE_AGGREGATES
+    if constexpr (aggregated) aggregate.add(value);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::Node::Node(const Node& other): keyValuePair(other.keyValuePair), parent(nullptr), left(nullptr), right(nullptr), color(other.color) {
+#ifdef BST_RANGE_AGGREGATES
+    if constexpr (aggregated) aggregate.add(keyValuePair.second);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::Node::operator==(const Node& other) const {
+    return keyValuePair == other.keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::Node::output_node_tree() const {
+    const Node *node = this;
+    while (node->left) node = node->left;
+    while (node) {
+        // Поток сбрасывается один раз в output_tree, а не после каждого узла
+        std::cout << (node->color == RED ? "[R] " : "[B] ") << node->keyValuePair.first << " : " << node->keyValuePair.second << '\n';
+        if (node->right) {
+            node = node->right;
+            while (node->left) node = node->left;
+        } else {
+            while (node != this && node == node->parent->right) node = node->parent;
+            node = node == this ? nullptr : node->parent;
+        }
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::isRed(Node* node) const {
+    return node && node->color == RED;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::rotate_left(Node *h) -> Node* {
+#ifdef BST_STATS
+    _stats.add(_stats.rotations);
+#endif
+    Node *x = h->right;
+    h->right = x->left;
+    if (x->left) x->left->parent = h;
+    x->left = h;
+    x->color = h->color;
+    h->color = RED;
+    x->parent = h->parent;
+    h->parent = x;
+    pull(h);
+    pull(x);
+    return x;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::rotate_right(Node *h) -> Node* {
+#ifdef BST_STATS
+    _stats.add(_stats.rotations);
+#endif
+    Node *x = h->left;
+    h->left = x->right;
+    if (x->right) x->right->parent = h;
+    x->right = h;
+    x->color = h->color;
+    h->color = RED;
+    x->parent = h->parent;
+    h->parent = x;
+    pull(h);
+    pull(x);
+    return x;
+}
+
+/*!***********************************************************
+Пересчитать дополнительные поля узла h по его потомкам. Поворот
+пересчитывает оба затронутых узла, а вставка и удаление, меняя
+число узлов поддерева, проходят pull_path от места изменения до
+корня. Без BST_ORDER_STATISTICS и BST_RANGE_AGGREGATES узел
+ничего не хранит, и обе функции пустые.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::pull(Node *h) {
+#ifdef BST_ORDER_STATISTICS
+    h->count = 1 + (h->left ? h->left->count : 0) + (h->right ? h->right->count : 0);
+#endif
+#ifdef BST_RANGE_AGGREGATES
+    if constexpr (aggregated) {
+        Aggregate aggregate;
+        aggregate.add(h->keyValuePair.second);
+        if (h->left) aggregate.merge(h->left->aggregate);
+        if (h->right) aggregate.merge(h->right->aggregate);
+        h->aggregate = aggregate;
+    }
+#endif
+    (void)h;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::pull_path(Node *h) {
+#if defined(BST_ORDER_STATISTICS) || defined(BST_RANGE_AGGREGATES)
+    for (; h; h = h->parent) pull(h);
+#else
+    (void)h;
+#endif
+}
+
+/*!***********************************************************
+Связи prev / next при сборке с BST_THREADED. Повороты порядок
+узлов не меняют, поэтому связи правятся только там, где узел
+появляется, исчезает или поддеревья сшиваются:
+  - thread_leaf - новый лист встаёт между родителем и соседом
+    родителя с другой стороны
+  - unthread - узел выпадает из списка перед удалением
+  - thread_seams - join_nodes(l, k, r) сшивает последний узел l,
+    k и первый узел r. Внутри отцепленных частей связи верны, а
+    крайние связи частей могут указывать куда угодно: их чинит
+    следующий join или thread_ends
+  - thread_ends - после операций над частями обнуляет крайние
+    связи и запоминает первый и последний узлы
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::thread_leaf(Node *node) {
+#ifdef BST_THREADED
+    Node *parent = node->parent;
+    if (!parent) {
+        node->prev = node->next = nullptr;
+    } else if (node == parent->left) {
+        node->prev = parent->prev;
+        node->next = parent;
+    } else {
+        node->prev = parent;
+        node->next = parent->next;
+    }
+    if (node->prev) {
+        node->prev->next = node;
+    } else {
+        _first = node;
+    }
+    if (node->next) {
+        node->next->prev = node;
+    } else {
+        _last = node;
+    }
+#else
+    (void)node;
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::unthread(Node *node) {
+#ifdef BST_THREADED
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        _first = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        _last = node->prev;
+    }
+#else
+    (void)node;
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::thread_seams(Node *l, Node *k, Node *r) {
+#ifdef BST_THREADED
+    k->prev = k->next = nullptr;
+    if (l) {
+        while (l->right) l = l->right;
+        l->next = k;
+        k->prev = l;
+    }
+    if (r) {
+        while (r->left) r = r->left;
+        r->prev = k;
+        k->next = r;
+    }
+#else
+    (void)l;
+    (void)k;
+    (void)r;
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::thread_ends() {
+#ifdef BST_THREADED
+    _first = _last = nullptr;
+    if (!_root) return;
+    _first = min_node(_root);
+    _first->prev = nullptr;
+    _last = _root;
+    while (_last->right) _last = _last->right;
+    _last->next = nullptr;
+#endif
+}
+
+/*!***********************************************************
+Кэш поиска BST_FIND_CACHE перед find_node в режиме Unique:
+  - cached_node / cache_node - поиск в кэше и запись найденного
+  - uncache убирает узел перед тем, как он будет разрушен или
+    его пара переедет в другой узел (erase_rb)
+  - flush_find_cache очищает кэш, когда узлы уходят целиком:
+    clear(), перемещение и присваивание дерева, absorb
+Вставка кэш не трогает: новый ключ в кэше отсутствовать не может
+иначе как промахом, а замена значения оставляет узел прежним.
+Без BST_FIND_CACHE все функции пустые.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::cached_node(KeyArg key) const -> Node* {
+#ifdef BST_FIND_CACHE
+    if constexpr (cached_keys) {
+        return _find_cache.find(std::hash<K>()(key), [&](const Node *node) {
+            return equal(node->keyValuePair.first, key);
+        });
+    }
+#endif
+    (void)key;
+    return nullptr;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::cache_node(KeyArg key, Node *node) const {
+#ifdef BST_FIND_CACHE
+    if constexpr (cached_keys) _find_cache.insert(std::hash<K>()(key), node);
+#endif
+    (void)key;
+    (void)node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::uncache(const Node *node) {
+#ifdef BST_FIND_CACHE
+    if constexpr (cached_keys) _find_cache.erase(std::hash<K>()(node->keyValuePair.first), node);
+#endif
+    (void)node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::flush_find_cache() {
+#ifdef BST_FIND_CACHE
+    _find_cache.clear();
+#endif
+}
+
+//! Учесть спуск поиска в счётчиках BST_STATS; без него функция пустая
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::note_search(size_t depth, size_t comparisons) const {
+#ifdef BST_STATS
+    _stats.search(depth, comparisons);
+#else
+    (void)depth;
+    (void)comparisons;
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::flip_colors(Node *h) {
+#ifdef BST_STATS
+    _stats.add(_stats.color_flips);
+#endif
+    h->color = h->color == RED ? BLACK : RED;
+    if (h->left) h->left->color = h->left->color == RED ? BLACK : RED;
+    if (h->right) h->right->color = h->right->color == RED ? BLACK : RED;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::move_red_left(Node *h) -> Node* {
+    flip_colors(h);
+    if (isRed(h->right->left)) {
+        h->right = rotate_right(h->right);
+        h = rotate_left(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::move_red_right(Node *h) -> Node* {
+    flip_colors(h);
+    if (isRed(h->left->left)) {
+        h = rotate_right(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::fix_up(Node *h) -> Node* {
+    if (isRed(h->right)) h = rotate_left(h);
+    if (isRed(h->left) && isRed(h->left->left)) h = rotate_right(h);
+    if (isRed(h->left) && isRed(h->right)) flip_colors(h);
+    return h;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::min_node(Node *h) -> Node* {
+    while (h->left) h = h->left;
+    return h;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::link_of(Node *h) -> Node** {
+    if (!h->parent) return &_root;
+    return h->parent->left == h ? &h->parent->left : &h->parent->right;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::insert(const K& key, const V& value) {
+    insert_rb(key, value);
+    _root->color = BLACK;
+}
+
+//! \param start узел, в поддереве которого лежит место вставки (по умолчанию корень)
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::insert_rb(const K& key, const V& value, Node *start) -> Node* {
+#ifdef BST_STATS
+    _stats.add(_stats.inserts);
+#endif
+    Node *parent = start ? start->parent : nullptr;
+    Node **link = start ? link_of(start) : &_root;
+    while (*link) {
+        parent = *link;
+        if (_mode == KeyMode::Multi) {
+            link = goes_left(key, value, parent->keyValuePair) ? &parent->left : &parent->right;
+        } else if (less(key, parent->keyValuePair.first)) {
+            link = &parent->left;
+        } else if (less(parent->keyValuePair.first, key)) {
+            link = &parent->right;
+        } else {
+            parent->keyValuePair.second = value;
+            pull_path(parent);
+            return parent;
+        }
+    }
+    Node *node = create_node(key, value, parent);
+    *link = node;
+    thread_leaf(node);
+    _size++;
+    pull_path(parent);
+    fix_insert(parent);
+    return node;
+}
+
+/*!***********************************************************
+Подъём от родителя нового узла к корню с теми же исправлениями,
+что выполняла рекурсивная вставка на обратном ходе. Подъём
+прекращается, когда на чёрном узле ничего не изменилось: выше
+него условия поворотов и перекраски остаются прежними.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::fix_insert(Node *h) {
+    while (h) {
+        Node *parent = h->parent;
+        Node **link = link_of(h);
+        Node *top = h;
+        bool flipped = false;
+        if (isRed(top->right) && !isRed(top->left)) top = rotate_left(top);
+        if (isRed(top->left) && isRed(top->left->left)) top = rotate_right(top);
+        if (isRed(top->left) && isRed(top->right)) {
+            flip_colors(top);
+            flipped = true;
+        }
+        *link = top;
+        if (top == h && !flipped && !isRed(h)) break;
+        h = parent;
+    }
+}
+
+//! \brief Идёт ли элемент (key, value) раньше элемента pair
+//! \note В режиме Multi повторы ключа упорядочены по значению, если значения
+//! сравнимы оператором <, равные пары идут в порядке вставки
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::goes_left(const K& key, const V& value, const std::pair<K, V> &pair) const {
+    if (less(key, pair.first)) return true;
+    if (_mode == KeyMode::Unique || less(pair.first, key)) return false;
+    if constexpr (ordered_values) {
+        return value < pair.second;
+    } else {
+        (void)value;
+        return false;
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::erase(const K& key) {
+    // Каждый проход удаляет один из повторов ключа. Проверка идёт мимо find_node:
+    // она не должна вытеснять узлы из кэша поиска и попадать в счётчики поиска
+    while (has_key(key)) {
+        if (!isRed(_root->left) && !isRed(_root->right)) _root->color = RED;
+        erase_rb(key);
+        if (_root) _root->color = BLACK;
+        _size--;
+        if (_mode == KeyMode::Unique) break;
+    }
+}
+
+/*!***********************************************************
+Нерекурсивное удаление сверху вниз:
+  - на спуске выполняются те же move_red_left / move_red_right,
+    что и в рекурсивной версии, каждый изменённый узел заново
+    подвешивается к родителю
+  - если удаляемый узел внутренний, в него копируется минимум
+    правого поддерева, и дальше спуск идёт только влево до этого
+    минимума
+  - удаляется всегда лист, после чего fix_up выполняется на всём
+    пути от его родителя до корня
+Ключ key должен присутствовать в дереве.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::erase_rb(const K &key) {
+#ifdef BST_STATS
+    _stats.add(_stats.erases);
+#endif
+    Node *h = _root;
+    bool erase_min = false;
+    while (true) {
+        if (erase_min || less(key, h->keyValuePair.first)) {
+            if (erase_min && !h->left) break;
+            if (!isRed(h->left) && !isRed(h->left->left)) {
+                Node **link = link_of(h);
+                *link = h = move_red_left(h);
+            }
+            h = h->left;
+            continue;
+        }
+        if (isRed(h->left)) {
+            Node **link = link_of(h);
+            *link = h = rotate_right(h);
+        }
+        if (equal(key, h->keyValuePair.first) && !h->right) break;
+        if (!isRed(h->right) && !isRed(h->right->left)) {
+            Node **link = link_of(h);
+            Node *top = h;
+            *link = h = move_red_right(h);
+            // После поворота сверху оказался левый потомок: среди равных
+            // ключей он может совпасть с key, но удалять нужно прежний узел,
+            // он теперь правый потомок
+            if (h != top) {
+                h = h->right;
+                continue;
+            }
+        }
+        if (equal(key, h->keyValuePair.first)) {
+            Node *min = min_node(h->right);
+            // Ключ h удаляется, а пара min переезжает в h: оба узла больше не там, где их помнит кэш
+            uncache(h);
+            uncache(min);
+            h->keyValuePair = std::move(min->keyValuePair);
+            erase_min = true;
+        }
+        h = h->right;
+    }
+
+    Node *parent = h->parent;
+    *link_of(h) = nullptr;
+    // Если ключ и значение переехали в узел выше, это узел-предшественник h в списке
+    unthread(h);
+    destroy_node(h);
+    while (parent) {
+        Node *up = parent->parent;
+        Node **link = link_of(parent);
+        pull(parent);
+        *link = fix_up(parent);
+        parent = up;
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::create_node(const K& key, const V& value, Node *parent) -> Node* {
+#ifdef BST_STATS
+    _stats.add(_stats.allocations);
+#endif
+    return new (_pool.allocate()) Node(key, value, parent);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::destroy_node(Node *node) {
+    uncache(node);
+#ifdef BST_STATS
+    _stats.add(_stats.deallocations);
+#endif
+    node->~Node();
+    _pool.deallocate(node);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::BasicBinarySearchTree(size_t nodes_per_slab) : _pool(nodes_per_slab) {}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::BasicBinarySearchTree(KeyMode mode, size_t nodes_per_slab, const Compare &compare, const Alloc &alloc)
+    : _mode(mode), _compare(compare), _pool(nodes_per_slab, 64 * 1024, alloc) {}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::less(KeyArg a, KeyArg b) const {
+    return _compare(a, b);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::equal(KeyArg a, KeyArg b) const {
+    if constexpr (natural_keys) {
+        return a == b;
+    } else {
+        return !_compare(a, b) && !_compare(b, a);
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+KeyMode BasicBinarySearchTree<K, V, Compare, Alloc>::key_mode() const {
+    return _mode;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::clear() {
+    // Узлы, владеющие ресурсами, разрушаются по одному, остальные пул отдаёт разом
+    if constexpr (!std::is_trivially_destructible_v<Node>) delete_subtree(_root);
+    // В кэше бывают только узлы непустого дерева
+    if (_root) flush_find_cache();
+    _pool.release();
+    _root = nullptr;
+    _size = 0;
+#ifdef BST_THREADED
+    _first = _last = nullptr;
+#endif
+}
+
+/*!***********************************************************
+Ёмкость 2-3 дерева с чёрной высотой h, где все узлы - 3-узлы,
+равна 3^h - 1, а наименьшее число ключей при той же высоте -
+2^h - 1. Возвращается наименьшая ёмкость вида 3^h - 1, не меньшая
+count; при ней count всегда не меньше 2^h - 1.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::sorted_capacity(size_t count) {
+    size_t capacity = 0;
+    while (capacity < count) capacity = capacity * 3 + 2;
+    return capacity;
+}
+
+/*!***********************************************************
+Связать отсортированные узлы nodes[0, count) в LLRB-поддерево
+с чёрной высотой h, где capacity = 3^h - 1:
+  - если оставшиеся count - 1 ключей помещаются в два поддерева
+    высоты h - 1, корень - 2-узел (один чёрный узел)
+  - иначе корень - 3-узел: чёрный узел с красным левым потомком
+    и три поддерева высоты h - 1
+Ключи делятся между поддеревьями поровну, поэтому каждое из них
+тоже укладывается в допустимый диапазон размеров.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::link_sorted(Node **nodes, size_t count, size_t capacity, Node *parent) -> Node* {
+    if (count == 0) return nullptr;
+    size_t child_capacity = (capacity - 2) / 3;
+
+    if (count - 1 <= 2 * child_capacity) {
+        size_t left_count = (count - 1) / 2;
+        Node *h = nodes[left_count];
+        h->parent = parent;
+        h->color = BLACK;
+        h->left = link_sorted(nodes, left_count, child_capacity, h);
+        h->right = link_sorted(nodes + left_count + 1, count - 1 - left_count, child_capacity, h);
+        pull(h);
+        return h;
+    }
+
+    size_t rest = count - 2;
+    size_t a_count = rest / 3 + (rest % 3 > 0);
+    size_t b_count = rest / 3 + (rest % 3 > 1);
+    size_t c_count = rest / 3;
+    Node *red = nodes[a_count];
+    Node *h = nodes[a_count + 1 + b_count];
+    h->parent = parent;
+    h->color = BLACK;
+    h->left = red;
+    red->parent = h;
+    red->color = RED;
+    red->left = link_sorted(nodes, a_count, child_capacity, red);
+    red->right = link_sorted(nodes + a_count + 1, b_count, child_capacity, red);
+    h->right = link_sorted(nodes + a_count + b_count + 2, c_count, child_capacity, h);
+    pull(red);
+    pull(h);
+    return h;
+}
+
+//! Собрать дерево из узлов, уже упорядоченных по ключу
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::relink_sorted(std::vector<Node*> &nodes) {
+    _root = link_sorted(nodes.data(), nodes.size(), sorted_capacity(nodes.size()), nullptr);
+    _size = nodes.size();
+#ifdef BST_THREADED
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i]->prev = i > 0 ? nodes[i - 1] : nullptr;
+        nodes[i]->next = i + 1 < nodes.size() ? nodes[i + 1] : nullptr;
+    }
+    _first = nodes.empty() ? nullptr : nodes.front();
+    _last = nodes.empty() ? nullptr : nodes.back();
+#endif
+}
+
+//! Сложить все узлы поддерева root (корня дерева или отцепленного) в nodes в порядке возрастания ключей
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::collect_nodes(std::vector<Node*> &nodes, Node *root) {
+    if (root == _root) nodes.reserve(nodes.size() + _size);
+    Node *node = root ? min_node(root) : nullptr;
+    while (node) {
+        nodes.push_back(node);
+        if (node->right) {
+            node = min_node(node->right);
+        } else {
+            while (node->parent && node == node->parent->right) node = node->parent;
+            node = node->parent;
+        }
+    }
+}
+
+//! Пересборка за O(n + m) выгоднее m спусков по O(log n)
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::prefer_rebuild(size_t batch_size) const {
+    return batch_size * 8 >= _size;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::insert_batch(std::vector<std::pair<K, V>> batch) {
+    std::stable_sort(batch.begin(), batch.end(), [this](const auto &a, const auto &b) {
+        return goes_left(a.first, a.second, b);
+    });
+    if (_mode == KeyMode::Unique) {
+        // Из повторов ключа остаётся последний
+        auto last = std::unique(batch.rbegin(), batch.rend(), [this](const auto &a, const auto &b) {
+            return equal(a.first, b.first);
+        });
+        batch.erase(batch.begin(), last.base());
+    }
+    if (batch.empty()) return;
+
+    if (!prefer_rebuild(batch.size())) {
+        Node *finger = nullptr;
+        for (const auto &pair : batch) {
+            // Подняться от предыдущего узла до поддерева, в котором лежит место вставки
+            Node *start = finger;
+            while (start && start->parent) {
+                if (start == start->parent->left && goes_left(pair.first, pair.second, start->parent->keyValuePair)) break;
+                start = start->parent;
+            }
+            finger = insert_rb(pair.first, pair.second, start);
+            _root->color = BLACK;
+        }
+        return;
+    }
+
+    std::vector<Node*> old_nodes;
+    collect_nodes(old_nodes, _root);
+    std::vector<Node*> nodes;
+    nodes.reserve(old_nodes.size() + batch.size());
+    auto old_it = old_nodes.begin();
+    for (const auto &pair : batch) {
+        while (old_it != old_nodes.end() && !goes_left(pair.first, pair.second, (*old_it)->keyValuePair)) {
+            if (_mode == KeyMode::Unique && equal((*old_it)->keyValuePair.first, pair.first)) break;
+            nodes.push_back(*old_it++);
+        }
+        if (_mode == KeyMode::Unique && old_it != old_nodes.end() && equal((*old_it)->keyValuePair.first, pair.first)) {
+            (*old_it)->keyValuePair.second = pair.second;
+            nodes.push_back(*old_it++);
+        } else {
+            nodes.push_back(create_node(pair.first, pair.second, nullptr));
+        }
+    }
+    nodes.insert(nodes.end(), old_it, old_nodes.end());
+    relink_sorted(nodes);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::erase_batch(std::vector<K> keys) {
+    std::sort(keys.begin(), keys.end(), _compare);
+    keys.erase(std::unique(keys.begin(), keys.end(), [this](const K &a, const K &b) {
+        return equal(a, b);
+    }), keys.end());
+    if (keys.empty() || !_root) return;
+
+    if (!prefer_rebuild(keys.size())) {
+        for (const K &key : keys) erase(key);
+        return;
+    }
+
+    std::vector<Node*> nodes;
+    collect_nodes(nodes, _root);
+    auto key_it = keys.begin();
+    size_t kept = 0;
+    for (Node *node : nodes) {
+        while (key_it != keys.end() && less(*key_it, node->keyValuePair.first)) ++key_it;
+        if (key_it != keys.end() && equal(*key_it, node->keyValuePair.first)) {
+            destroy_node(node);
+        } else {
+            nodes[kept++] = node;
+        }
+    }
+    nodes.resize(kept);
+    relink_sorted(nodes);
+}
+
+//! Отцепить поддерево от родителя и сделать его корень чёрным (чёрная высота может вырасти на 1)
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::detach(Node *h) -> Node* {
+    if (h) {
+        h->parent = nullptr;
+        h->color = BLACK;
+    }
+    return h;
+}
+
+//! Число чёрных узлов на пути от h до листа
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::black_height(const Node *h) {
+    size_t height = 0;
+    for (; h; h = h->left) height += h->color == BLACK;
+    return height;
+}
+
+/*!***********************************************************
+Спуск по правому краю l до чёрного узла с чёрной высотой rh: на
+его место встаёт красный k с детьми (узел, r). Это та же вставка
+красного узла, что и в insert, поэтому на обратном ходе путь
+чинится fix_up.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::join_right(Node *l, size_t lh, Node *k, Node *r, size_t rh) -> Node* {
+    if (!isRed(l) && lh == rh) {
+        k->left = l;
+        k->right = r;
+        k->color = RED;
+        if (l) l->parent = k;
+        if (r) r->parent = k;
+        pull(k);
+        return k;
+    }
+    Node *child = join_right(l->right, lh - !isRed(l), k, r, rh);
+    l->right = child;
+    child->parent = l;
+    pull(l);
+    return fix_up(l);
+}
+
+//! Зеркально join_right: спуск по левому краю r до чёрного узла с чёрной высотой lh
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::join_left(Node *l, size_t lh, Node *k, Node *r, size_t rh) -> Node* {
+    if (!isRed(r) && lh == rh) {
+        k->left = l;
+        k->right = r;
+        k->color = RED;
+        if (l) l->parent = k;
+        if (r) r->parent = k;
+        pull(k);
+        return k;
+    }
+    Node *child = join_left(l, lh, k, r->left, rh - !isRed(r));
+    r->left = child;
+    child->parent = r;
+    pull(r);
+    return fix_up(r);
+}
+
+//! \brief Собрать дерево из l, узла k и r за O(|bh(l) - bh(r)| + log n)
+//! \note Все элементы l идут до k, все элементы r - после; корни l и r чёрные
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::join_nodes(Node *l, Node *k, Node *r) -> Node* {
+    thread_seams(l, k, r);
+    size_t lh = black_height(l);
+    size_t rh = black_height(r);
+    Node *root;
+    if (lh > rh) {
+        root = join_right(l, lh, k, r, rh);
+    } else if (lh < rh) {
+        root = join_left(l, lh, k, r, rh);
+    } else {
+        k->left = l;
+        k->right = r;
+        if (l) l->parent = k;
+        if (r) r->parent = k;
+        pull(k);
+        root = k;
+    }
+    root->parent = nullptr;
+    root->color = BLACK;
+    return root;
+}
+
+//! Собрать дерево из l и r без разделяющего узла: им становится последний узел l
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::join2(Node *l, Node *r) -> Node* {
+    if (!l) return r;
+    if (!r) return l;
+    Node *last = nullptr;
+    l = split_last(l, last);
+    return join_nodes(l, last, r);
+}
+
+//! Отрезать от дерева h последний узел last, вернуть оставшееся дерево
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::split_last(Node *h, Node *&last) -> Node* {
+    Node *l = detach(h->left);
+    Node *r = detach(h->right);
+    h->left = h->right = nullptr;
+    if (!r) {
+        last = h;
+        pull(h);
+        return l;
+    }
+    Node *rest = split_last(r, last);
+    return join_nodes(l, h, rest);
+}
+
+/*!***********************************************************
+Разрезать дерево h. side(node) < 0 - узел идёт в левую часть,
+> 0 - в правую, 0 - в среднюю (равные ключу разреза); side
+монотонна по порядку узлов. Каждый уровень спуска добавляет
+один join к части, в которую не пошёл спуск.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+template <typename Side>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::split_nodes(Node *h, const Side &side) -> Split {
+    if (!h) return {};
+    Node *l = detach(h->left);
+    Node *r = detach(h->right);
+    h->left = h->right = nullptr;
+    int where = side(h);
+    if (where > 0) {
+        Split parts = split_nodes(l, side);
+        parts.right = join_nodes(parts.right, h, r);
+        return parts;
+    }
+    if (where < 0) {
+        Split parts = split_nodes(r, side);
+        parts.left = join_nodes(l, h, parts.left);
+        return parts;
+    }
+    // Равные ключу узлы могут быть по обе стороны (режим Multi)
+    Split left = split_nodes(l, side);
+    Split right = split_nodes(r, side);
+    return {left.left, join_nodes(left.mid, h, right.mid), right.right};
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::split_by_key(Node *h, KeyArg key) -> Split {
+    return split_nodes(h, [this, key](const Node *node) {
+        if (less(node->keyValuePair.first, key)) return -1;
+        return less(key, node->keyValuePair.first) ? 1 : 0;
+    });
+}
+
+//! Глубина рекурсии, до которой fork отдаёт ветви пулу; 0, если у пула нет рабочих потоков
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::fork_depth() {
+    size_t threads = ThreadPool::shared().concurrency();
+    if (threads <= 1) return 0;
+    // Задач примерно в 16 раз больше потоков, чтобы неровные половины выравнивались
+    size_t depth = 4;
+    for (; threads > 1; threads >>= 1) ++depth;
+    return depth;
+}
+
+//! Выполнить две независимые ветви рекурсии: на верхних уровнях - параллельно
+template <typename K, typename V, typename Compare, typename Alloc>
+template <typename Left, typename Right>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::fork(size_t depth, Left &&left, Right &&right) {
+    if (depth < fork_depth()) {
+        ThreadPool::shared().fork_join(left, right);
+    } else {
+        left();
+        right();
+    }
+}
+
+//! Объединение: корень b разрезает a, половины объединяются рекурсивно
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::unite_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage) -> Node* {
+    if (!a) return b;
+    if (!b) return a;
+    Node *k = b;
+    Node *bl = detach(k->left);
+    Node *br = detach(k->right);
+    Split parts;
+    if (_mode == KeyMode::Multi) {
+        // Все элементы обоих деревьев остаются: a режется по паре ключ - значение k
+        parts = split_nodes(a, [this, k](const Node *node) {
+            return goes_left(k->keyValuePair.first, k->keyValuePair.second, node->keyValuePair) ? 1 : -1;
+        });
+    } else {
+        parts = split_by_key(a, k->keyValuePair.first);
+        // Повтор ключа: остаётся значение из b
+        if (parts.mid) garbage.push_back(parts.mid);
+    }
+    Node *l = nullptr;
+    Node *r = nullptr;
+    std::vector<Node*> left_garbage;
+    fork(depth,
+         [&] { l = unite_nodes(parts.left, bl, depth + 1, left_garbage); },
+         [&] { r = unite_nodes(parts.right, br, depth + 1, garbage); });
+    garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+    return join_nodes(l, k, r);
+}
+
+//! Пересечение: корень b разрезает a, равные ему узлы a остаются, сам корень b удаляется
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::intersect_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage) -> Node* {
+    if (!a || !b) {
+        if (a) garbage.push_back(a);
+        if (b) garbage.push_back(b);
+        return nullptr;
+    }
+    Node *k = b;
+    Node *bl = detach(k->left);
+    Node *br = detach(k->right);
+    k->left = k->right = nullptr;
+    garbage.push_back(k);
+    Split parts = split_by_key(a, k->keyValuePair.first);
+    Node *l = nullptr;
+    Node *r = nullptr;
+    std::vector<Node*> left_garbage;
+    fork(depth,
+         [&] { l = intersect_nodes(parts.left, bl, depth + 1, left_garbage); },
+         [&] { r = intersect_nodes(parts.right, br, depth + 1, garbage); });
+    garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+    return join2(join2(l, parts.mid), r);
+}
+
+//! Разность: корень b разрезает a, равные ему узлы a и сам корень b удаляются
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::difference_nodes(Node *a, Node *b, size_t depth, std::vector<Node*> &garbage) -> Node* {
+    if (!a || !b) {
+        if (b) garbage.push_back(b);
+        return a;
+    }
+    Node *k = b;
+    Node *bl = detach(k->left);
+    Node *br = detach(k->right);
+    k->left = k->right = nullptr;
+    garbage.push_back(k);
+    Split parts = split_by_key(a, k->keyValuePair.first);
+    if (parts.mid) garbage.push_back(parts.mid);
+    Node *l = nullptr;
+    Node *r = nullptr;
+    std::vector<Node*> left_garbage;
+    fork(depth,
+         [&] { l = difference_nodes(parts.left, bl, depth + 1, left_garbage); },
+         [&] { r = difference_nodes(parts.right, br, depth + 1, garbage); });
+    garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+    return join2(l, r);
+}
+
+//! \brief Забрать узлы other в пул дерева; вернуть отцепленный корень other, other становится пустым
+//! \note Блоки пула other переходят целиком, только если аллокаторы равны, иначе узлы копируются
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::absorb(BasicBinarySearchTree &other) -> Node* {
+    if constexpr (!std::allocator_traits<NodeAlloc>::is_always_equal::value) {
+        if (_pool.get_allocator() != other._pool.get_allocator()) {
+            // Блоки other нельзя отдавать аллокатору этого дерева: узлы копируются в пул с его аллокатором
+            BasicBinarySearchTree copy(other._mode, 64, other._compare, get_allocator());
+            copy.clone_from(other);
+            other.clear();
+            return absorb(copy);
+        }
+    }
+    _pool.splice(std::move(other._pool));
+    other.flush_find_cache();
+    Node *root = detach(other._root);
+    _size += other._size;
+    other._root = nullptr;
+    other._size = 0;
+#ifdef BST_THREADED
+    other._first = other._last = nullptr;
+#endif
+    return root;
+}
+
+//! Удалить отцепленные поддеревья, вернуть число удалённых узлов
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::destroy_detached(const std::vector<Node*> &roots) {
+    size_t count = 0;
+    std::vector<Node*> stack(roots.begin(), roots.end());
+    while (!stack.empty()) {
+        Node *node = stack.back();
+        stack.pop_back();
+        if (node->left) stack.push_back(node->left);
+        if (node->right) stack.push_back(node->right);
+        destroy_node(node);
+        ++count;
+    }
+    return count;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::join(BasicBinarySearchTree &&other) {
+    if (this == &other || !other._root) return;
+    if (_root) {
+        const Node *last = _root;
+        while (last->right) last = last->right;
+        const Node *first = min_node(other._root);
+        bool ordered = _mode == KeyMode::Multi
+            ? !goes_left(first->keyValuePair.first, first->keyValuePair.second, last->keyValuePair)
+            : less(last->keyValuePair.first, first->keyValuePair.first);
+        if (!ordered) {
+            unite(std::move(other));
+            return;
+        }
+    }
+    Node *root = absorb(other);
+    _root = join2(detach(_root), root);
+    thread_ends();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::split(const K &key) -> BasicBinarySearchTree {
+    BasicBinarySearchTree upper(_mode, 64, _compare, get_allocator());
+    Split parts = split_by_key(detach(_root), key);
+    _root = parts.left;
+    thread_ends();
+    // Отделённые узлы лежат в пуле этого дерева: новое дерево собирается из их копий
+    std::vector<Node*> nodes;
+    collect_nodes(nodes, join2(parts.mid, parts.right));
+    std::vector<Node*> copies;
+    copies.reserve(nodes.size());
+    for (Node *node : nodes) {
+        copies.push_back(upper.create_node(node->keyValuePair.first, node->keyValuePair.second, nullptr));
+        destroy_node(node);
+    }
+    upper.relink_sorted(copies);
+    _size -= copies.size();
+    // Конструктор перемещения explicit: возвращается временный объект
+    return BasicBinarySearchTree(std::move(upper));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::unite(BasicBinarySearchTree &&other) {
+    if (this == &other) return;
+    Node *b = absorb(other);
+    std::vector<Node*> garbage;
+    _root = unite_nodes(detach(_root), b, 0, garbage);
+    _size -= destroy_detached(garbage);
+    thread_ends();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::intersect(BasicBinarySearchTree &&other) {
+    if (this == &other) return;
+    Node *b = absorb(other);
+    std::vector<Node*> garbage;
+    _root = intersect_nodes(detach(_root), b, 0, garbage);
+    _size -= destroy_detached(garbage);
+    thread_ends();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::difference(BasicBinarySearchTree &&other) {
+    if (this == &other) {
+        clear();
+        return;
+    }
+    Node *b = absorb(other);
+    std::vector<Node*> garbage;
+    _root = difference_nodes(detach(_root), b, 0, garbage);
+    _size -= destroy_detached(garbage);
+    thread_ends();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::save(const std::string &path) const {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "save пишет ключи и значения байтами, как они лежат в памяти");
+    tree_file::Header header = tree_file::make_header(sizeof(K), sizeof(V), uint32_t(_mode), _size);
+    std::string temporary = path + ".tmp";
+    {
+        tree_file::MappedFile file = tree_file::MappedFile::create(temporary, header.file_size);
+        unsigned char *keys = file.data() + header.keys_offset;
+        unsigned char *values = file.data() + header.values_offset;
+        for (auto it = cbegin(); it != cend(); ++it) {
+            std::memcpy(keys, &it->first, sizeof(K));
+            std::memcpy(values, &it->second, sizeof(V));
+            keys += sizeof(K);
+            values += sizeof(V);
+        }
+        header.checksum = tree_file::checksum(file.data() + sizeof(header), file.size() - sizeof(header));
+        std::memcpy(file.data(), &header, sizeof(header));
+        file.sync();
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) tree_file::MappedFile::fail("rename", path);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::load(const std::string &path) {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "load читает ключи и значения байтами, как они лежат в памяти");
+    tree_file::MappedFile file = tree_file::MappedFile::open(path);
+    file.advise(MADV_SEQUENTIAL);
+    const tree_file::Header &header = tree_file::check_header(file, sizeof(K), sizeof(V), true);
+    KeyMode mode = KeyMode(header.key_mode);
+    const unsigned char *keys = file.data() + header.keys_offset;
+    const unsigned char *values = file.data() + header.values_offset;
+
+    clear();
+    _mode = mode;
+    std::vector<Node*> nodes;
+    nodes.reserve(header.count);
+    for (uint64_t i = 0; i < header.count; ++i) {
+        K key;
+        V value;
+        std::memcpy(&key, keys + i * sizeof(K), sizeof(K));
+        std::memcpy(&value, values + i * sizeof(V), sizeof(V));
+        // Сумма сходится и у файла, записанного не save: порядок проверяется отдельно
+        if (!nodes.empty()) {
+            const K &previous = nodes.back()->keyValuePair.first;
+            if (mode == KeyMode::Unique ? !less(previous, key) : less(key, previous)) {
+                relink_sorted(nodes);
+                clear();
+                throw std::runtime_error("tree_file: ключи в файле не упорядочены");
+            }
+        }
+        nodes.push_back(create_node(key, value, nullptr));
+    }
+    relink_sorted(nodes);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::export_text(std::ostream &out) const {
+    static_assert(bst_detail::is_text_field<K> && bst_detail::is_text_field<V>,
+                  "export_text пишет ключи и значения через std::to_chars");
+    // Самое длинное число (double в кратчайшей записи, int64 со знаком) короче 32 символов
+    constexpr size_t max_line = 2 * 32 + 2;
+    std::vector<char> buffer(64 * 1024);
+    char *pos = buffer.data();
+    char *end = buffer.data() + buffer.size();
+    for (auto it = scan(nullptr, nullptr); it != ScanIterator(); ++it) {
+        if (size_t(end - pos) < max_line) {
+            out.write(buffer.data(), pos - buffer.data());
+            pos = buffer.data();
+        }
+        pos = std::to_chars(pos, end, it->first).ptr;
+        *pos++ = ',';
+        pos = std::to_chars(pos, end, it->second).ptr;
+        *pos++ = '\n';
+    }
+    out.write(buffer.data(), pos - buffer.data());
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::import_text(std::istream &in) {
+    static_assert(bst_detail::is_text_field<K> && bst_detail::is_text_field<V>,
+                  "import_text читает ключи и значения через std::from_chars");
+    constexpr size_t chunk = 1 << 20;     //!< байт за одно чтение
+    constexpr size_t batch_size = 1 << 16; //!< строк в одной пачке insert_batch
+
+    // Пока порядок не нарушен, узлы копятся в nodes и собираются в дерево один раз
+    bool ordered = _root == nullptr;
+    std::vector<Node*> nodes;
+    std::vector<std::pair<K, V>> batch;
+    size_t lines = 0;
+    size_t imported = 0;
+    bool failed = false;
+
+    auto add = [&](const K &key, const V &value) {
+        ++imported;
+        if (ordered && !nodes.empty()) {
+            const std::pair<K, V> &previous = nodes.back()->keyValuePair;
+            if (_mode == KeyMode::Unique && equal(previous.first, key)) {
+                nodes.back()->keyValuePair.second = value;
+                return;
+            }
+            if (goes_left(key, value, previous)) {
+                relink_sorted(nodes);
+                nodes = std::vector<Node*>();
+                ordered = false;
+            }
+        }
+        if (ordered) {
+            nodes.push_back(create_node(key, value, nullptr));
+            return;
+        }
+        batch.emplace_back(key, value);
+        if (batch.size() == batch_size) {
+            insert_batch(std::move(batch));
+            batch.clear();
+        }
+    };
+    auto parse = [&](const char *first, const char *last) {
+        ++lines;
+        if (first != last && last[-1] == '\r') --last;
+        if (bst_detail::skip_blanks(first, last) == last) return true;
+        K key;
+        V value;
+        if (!bst_detail::parse_text_line(first, last, key, value)) return false;
+        add(key, value);
+        return true;
+    };
+
+    std::vector<char> buffer(chunk);
+    size_t filled = 0; // байт неполной строки с прошлого чтения в начале буфера
+    while (!failed && in) {
+        if (filled == buffer.size()) buffer.resize(buffer.size() * 2); // строка длиннее буфера
+        in.read(buffer.data() + filled, std::streamsize(buffer.size() - filled));
+        size_t size = filled + size_t(in.gcount());
+        const char *first = buffer.data();
+        const char *last = buffer.data() + size;
+        while (const char *newline = static_cast<const char *>(std::memchr(first, '\n', last - first))) {
+            if (!parse(first, newline)) {
+                failed = true;
+                break;
+            }
+            first = newline + 1;
+        }
+        filled = size_t(last - first);
+        if (!failed && filled > 0) {
+            if (in) {
+                std::memmove(buffer.data(), first, filled);
+            } else if (!parse(first, last)) { // последняя строка без перевода строки
+                failed = true;
+            }
+        }
+    }
+
+    if (ordered) {
+        relink_sorted(nodes);
+    } else if (!batch.empty()) {
+        insert_batch(std::move(batch));
+    }
+    if (failed) {
+        throw std::runtime_error("import_text: строка " + std::to_string(lines) + " не в формате key,value");
+    }
+    return imported;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::BasicBinarySearchTree(const BasicBinarySearchTree& other)
+    : _mode(other._mode), _compare(other._compare),
+      _pool(64, 64 * 1024,
+            std::allocator_traits<NodeAlloc>::select_on_container_copy_construction(other._pool.get_allocator())) {
+    clone_from(other);
+}
+
+/*!***********************************************************
+Копия дерева other той же формы за один обход O(n):
+  - узлы копии берутся из одного блока пула на other.size()
+    узлов; цвета, ссылки parent и дополнительные поля
+    повторяют other
+  - на верхних уровнях левое и правое поддеревья копируются
+    параллельно (см. fork); каждая ветвь берёт узлы из блока
+    кусками, поэтому внутри куска узлы лежат в порядке обхода
+  - параллельной ветви может не хватить части последнего куска,
+    поэтому блок больше other.size() примерно на 1/16; остатки
+    кусков уходят в список свободных пула и достаются вставкам
+Небольшие деревья копируются одной ветвью в блок точного размера.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::clone_from(const BasicBinarySearchTree &other) {
+    if (!other._root) return;
+    // Раздача задач пулу окупается только на больших деревьях
+    const size_t parallel_size = 64 * 1024;
+    CloneBlock block;
+    block.fork_depth = other._size >= parallel_size ? fork_depth() : 0;
+    // Каждый fork заводит ещё одну ветвь, а у ветви недоиспользован не больше чем один кусок
+    size_t branches = size_t(1) << block.fork_depth;
+    block.chunk = block.fork_depth ? std::max<size_t>(64, other._size / (16 * branches)) : other._size;
+    block.capacity = other._size + (block.fork_depth ? branches * block.chunk : 0);
+    block.nodes = _pool.allocate_block(block.capacity);
+
+    CloneCursor cursor;
+    std::vector<CloneCursor> leftovers;
+    Cloned cloned = clone_nodes(other._root, 0, block, cursor, leftovers);
+    leftovers.push_back(cursor);
+    leftovers.push_back({block.nodes + std::min(block.taken.load(), block.capacity), block.nodes + block.capacity});
+    for (const CloneCursor &rest : leftovers) {
+        for (Node *slot = rest.next; slot != rest.end; ++slot) _pool.deallocate(slot);
+    }
+    _root = cloned.root;
+    _size = other._size;
+#ifdef BST_THREADED
+    _first = cloned.first;
+    _last = cloned.last;
+#endif
+#ifdef BST_STATS
+    _stats.add(_stats.allocations, _size);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::clone_nodes(const Node *h, size_t depth, CloneBlock &block,
+                                                              CloneCursor &cursor, std::vector<CloneCursor> &leftovers) -> Cloned {
+    if (cursor.next == cursor.end) {
+        size_t first = block.taken.fetch_add(block.chunk, std::memory_order_relaxed);
+        cursor.next = block.nodes + first;
+        cursor.end = block.nodes + std::min(first + block.chunk, block.capacity);
+    }
+    Node *copy = new (cursor.next++) Node(*h);
+    Cloned left;
+    Cloned right;
+    if (depth < block.fork_depth && h->left && h->right) {
+        CloneCursor right_cursor;
+        std::vector<CloneCursor> right_leftovers;
+        fork(depth,
+             [&] { left = clone_nodes(h->left, depth + 1, block, cursor, leftovers); },
+             [&] { right = clone_nodes(h->right, depth + 1, block, right_cursor, right_leftovers); });
+        leftovers.insert(leftovers.end(), right_leftovers.begin(), right_leftovers.end());
+        leftovers.push_back(right_cursor);
+    } else {
+        if (h->left) left = clone_nodes(h->left, depth + 1, block, cursor, leftovers);
+        if (h->right) right = clone_nodes(h->right, depth + 1, block, cursor, leftovers);
+    }
+    copy->left = left.root;
+    copy->right = right.root;
+    if (left.root) left.root->parent = copy;
+    if (right.root) right.root->parent = copy;
+    pull(copy);
+#ifdef BST_THREADED
+    // Соседи копии по порядку - крайние узлы скопированных поддеревьев
+    copy->prev = left.last;
+    copy->next = right.first;
+    if (left.last) left.last->next = copy;
+    if (right.first) right.first->prev = copy;
+#endif
+    return {copy, left.root ? left.first : copy, right.root ? right.last : copy};
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::operator=(const BasicBinarySearchTree& other) -> BasicBinarySearchTree& {
+    if (this != &other) {
+        // Копия собирается в пул с тем аллокатором, который останется у дерева после присваивания
+        Alloc alloc = std::allocator_traits<NodeAlloc>::propagate_on_container_copy_assignment::value
+            ? other.get_allocator() : get_allocator();
+        BasicBinarySearchTree temp(other._mode, 64, other._compare, alloc);
+        temp.clone_from(other);
+        flush_find_cache();
+        std::swap(_mode, temp._mode);
+        std::swap(_compare, temp._compare);
+        std::swap(_root, temp._root);
+        std::swap(_size, temp._size);
+#ifdef BST_THREADED
+        std::swap(_first, temp._first);
+        std::swap(_last, temp._last);
+#endif
+        _pool.swap(temp._pool);
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::BasicBinarySearchTree(BasicBinarySearchTree&& other) noexcept : _mode(other._mode), _size(other._size), _root(other._root), _compare(std::move(other._compare)), _pool(std::move(other._pool)) {
+#ifdef BST_THREADED
+    _first = other._first;
+    _last = other._last;
+    other._first = other._last = nullptr;
+#endif
+    other.flush_find_cache();
+    other._root = nullptr;
+    other._size = 0;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::operator=(BasicBinarySearchTree&& other) noexcept -> BasicBinarySearchTree& {
+    if (this != &other) {
+        clear();
+        _pool = std::move(other._pool);
+        _compare = std::move(other._compare);
+        _mode = other._mode;
+        _root = other._root;
+        _size = other._size;
+        other.flush_find_cache();
+        other._root = nullptr;
+        other._size = 0;
+#ifdef BST_THREADED
+        _first = other._first;
+        _last = other._last;
+        other._first = other._last = nullptr;
+#endif
+    }
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::delete_subtree(Node* node) {
+    if (!node) return;
+    if (node->parent) *link_of(node) = nullptr;
+    node->parent = nullptr;
+    // Спуск до листа, удаление листа и возврат к родителю
+    while (node) {
+        if (node->left) {
+            node = node->left;
+        } else if (node->right) {
+            node = node->right;
+        } else {
+            Node *parent = node->parent;
+            if (parent) *link_of(node) = nullptr;
+            destroy_node(node);
+            node = parent;
+        }
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::~BasicBinarySearchTree() {
+    clear();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::Iterator(Node* node) : _node(node) {}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+std::pair<K, V>& BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator*() {
+    return _node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+const std::pair<K, V>& BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator*() const {
+    return _node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+std::pair<K, V>* BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator->() {
+    return &_node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+const std::pair<K, V>* BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator->() const {
+    return &_node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator++() -> Iterator {
+#ifdef BST_THREADED
+    _node = _node->next;
+#else
+    if (_node->right) {
+        _node = _node->right;
+        while (_node->left) _node = _node->left;
+    } else {
+        Node* parent = _node->parent;
+        while (parent && _node == parent->right) {
+            _node = parent;
+            parent = parent->parent;
+        }
+        _node = parent;
+    }
+#endif
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator++(int) -> Iterator {
+    Iterator temp = *this;
+    ++(*this);
+    return temp;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator--() -> Iterator {
+#ifdef BST_THREADED
+    _node = _node->prev;
+#else
+    if (_node->left) {
+        _node = _node->left;
+        while (_node->right) _node = _node->right;
+    } else {
+        Node* parent = _node->parent;
+        while (parent && _node == parent->left) {
+            _node = parent;
+            parent = parent->parent;
+        }
+        _node = parent;
+    }
+#endif
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator--(int) -> Iterator {
+    Iterator temp = *this;
+    --(*this);
+    return temp;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator==(const Iterator& other) const {
+    return _node == other._node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::Iterator::operator!=(const Iterator& other) const {
+    return _node != other._node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::ConstIterator(const Node* node) : _node(node) {}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+const std::pair<K, V>& BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator*() const {
+    return _node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+const std::pair<K, V>* BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator->() const {
+    return &_node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator++() -> ConstIterator {
+#ifdef BST_THREADED
+    _node = _node->next;
+#else
+    if (_node->right) {
+        _node = _node->right;
+        while (_node->left) _node = _node->left;
+    } else {
+        const Node* parent = _node->parent;
+        while (parent && _node == parent->right) {
+            _node = parent;
+            parent = parent->parent;
+        }
+        _node = parent;
+    }
+#endif
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator++(int) -> ConstIterator {
+    ConstIterator temp = *this;
+    ++(*this);
+    return temp;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator--() -> ConstIterator {
+#ifdef BST_THREADED
+    _node = _node->prev;
+#else
+    if (_node->left) {
+        _node = _node->left;
+        while (_node->right) _node = _node->right;
+    } else {
+        const Node* parent = _node->parent;
+        while (parent && _node == parent->left) {
+            _node = parent;
+            parent = parent->parent;
+        }
+        _node = parent;
+    }
+#endif
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator--(int) -> ConstIterator {
+    ConstIterator temp = *this;
+    --(*this);
+    return temp;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator==(const ConstIterator& other) const {
+    return _node == other._node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::ConstIterator::operator!=(const ConstIterator& other) const {
+    return _node != other._node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator*() const -> reference {
+    return _node->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator->() const -> pointer {
+    return &_node->keyValuePair;
+}
+
+//! Положить в стек узел и весь его левый край
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::push_left(const Node *node) {
+    for (; node; node = node->left) {
+        __builtin_prefetch(node->right);
+        _stack[_depth++] = node;
+    }
+}
+
+//! Сделать текущим узел с вершины стека, если он ещё в диапазоне
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::pop() {
+    _node = _depth ? _stack[--_depth] : nullptr;
+    if (_node && _bounded && !_tree->less(_node->keyValuePair.first, _hi)) _node = nullptr;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator++() -> ScanIterator& {
+    push_left(_node->right);
+    pop();
+    return *this;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator++(int) -> ScanIterator {
+    ScanIterator temp = *this;
+    ++(*this);
+    return temp;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator==(const ScanIterator& other) const {
+    return _node == other._node;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::ScanIterator::operator!=(const ScanIterator& other) const {
+    return _node != other._node;
+}
+
+//! \brief Итератор просмотра от первого элемента с ключем не меньше *lo до ключа *hi
+//! \note lo == nullptr - от начала дерева, hi == nullptr - до конца
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::scan(const K *lo, const K *hi) const -> ScanIterator {
+    ScanIterator it;
+    it._tree = this;
+    if (hi) {
+        it._bounded = true;
+        it._hi = *hi;
+    }
+    if (!lo) {
+        it.push_left(_root);
+    } else {
+        // Спуск как в lower_bound_node: в стек попадают узлы, от которых спуск ушёл влево
+        for (const Node *node = _root; node;) {
+            if (less(node->keyValuePair.first, *lo)) {
+                node = node->right;
+            } else {
+                __builtin_prefetch(node->right);
+                it._stack[it._depth++] = node;
+                node = node->left;
+            }
+        }
+    }
+    it.pop();
+    return it;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+BasicBinarySearchTree<K, V, Compare, Alloc>::RangeView::RangeView(const BasicBinarySearchTree *tree, const K &lo, const K &hi)
+    : _tree(tree), _lo(lo), _hi(hi) {}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::RangeView::begin() const -> ScanIterator {
+    if (!_tree->less(_lo, _hi)) return ScanIterator();
+    return _tree->scan(&_lo, &_hi);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::RangeView::end() const -> ScanIterator {
+    return ScanIterator();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::RangeView::empty() const {
+    if (!_tree->less(_lo, _hi)) return true;
+    Node *first = _tree->lower_bound_node(_lo);
+    return !first || !_tree->less(first->keyValuePair.first, _hi);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::range(const K& lo, const K& hi) const -> RangeView {
+    return RangeView(this, lo, hi);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::lower_bound(const K& key) -> Iterator {
+    return Iterator(lower_bound_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::lower_bound(const K& key) const -> ConstIterator {
+    return ConstIterator(lower_bound_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::upper_bound(const K& key) -> Iterator {
+    return Iterator(upper_bound_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::upper_bound(const K& key) const -> ConstIterator {
+    return ConstIterator(upper_bound_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::find_node(KeyArg key) const -> Node* {
+    if (_mode == KeyMode::Multi) {
+        // Первый из повторов ключа
+        Node *first = lower_bound_node(key);
+        return first && equal(first->keyValuePair.first, key) ? first : nullptr;
+    }
+    if (Node *cached = cached_node(key)) return cached;
+    Node* current = _root;
+    size_t depth = 0;
+    size_t comparisons = 0;
+    while (current) {
+        ++depth;
+        if (less(key, current->keyValuePair.first)) {
+            comparisons += 1;
+            current = current->left;
+        } else if (less(current->keyValuePair.first, key)) {
+            comparisons += 2;
+            current = current->right;
+        } else {
+            note_search(depth, comparisons + 2);
+            cache_node(key, current);
+            return current;
+        }
+    }
+    note_search(depth, comparisons);
+    return nullptr;
+}
+
+//! Есть ли узел с ключем key: спуск без кэша поиска и без счётчиков stats()
+template <typename K, typename V, typename Compare, typename Alloc>
+bool BasicBinarySearchTree<K, V, Compare, Alloc>::has_key(KeyArg key) const {
+    Node *current = _root;
+    while (current) {
+        if (less(key, current->keyValuePair.first)) {
+            current = current->left;
+        } else if (less(current->keyValuePair.first, key)) {
+            current = current->right;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! Первый узел с ключем не меньше key
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::lower_bound_node(KeyArg key) const -> Node* {
+    Node *current = _root;
+    Node *result = nullptr;
+    size_t depth = 0;
+    while (current) {
+        ++depth;
+        if (less(current->keyValuePair.first, key)) {
+            current = current->right;
+        } else {
+            result = current;
+            current = current->left;
+        }
+    }
+    note_search(depth, depth);
+    return result;
+}
+
+//! Первый узел с ключем больше key
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::upper_bound_node(KeyArg key) const -> Node* {
+    Node *current = _root;
+    Node *result = nullptr;
+    size_t depth = 0;
+    while (current) {
+        ++depth;
+        if (less(key, current->keyValuePair.first)) {
+            result = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+    note_search(depth, depth);
+    return result;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::find(const K& key) const -> ConstIterator {
+    return ConstIterator(find_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::find(const K& key) -> Iterator {
+    return Iterator(find_node(key));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::find_many(const K *keys, size_t count, V *out, bool *found) const {
+    constexpr size_t GROUP = 16;
+    const Node *nodes[GROUP];
+    for (size_t base = 0; base < count; base += GROUP) {
+        size_t group = std::min(GROUP, count - base);
+        for (size_t j = 0; j < group; ++j) {
+            nodes[j] = _root;
+            found[base + j] = false;
+        }
+        size_t active = group;
+        while (active) {
+            active = 0;
+            for (size_t j = 0; j < group; ++j) {
+                const Node *node = nodes[j];
+                if (!node) continue;
+                const K &key = keys[base + j];
+                if (less(key, node->keyValuePair.first)) {
+                    node = node->left;
+                } else if (less(node->keyValuePair.first, key)) {
+                    node = node->right;
+                } else {
+                    out[base + j] = node->keyValuePair.second;
+                    found[base + j] = true;
+                    // Среди повторов нужен первый, он может быть только левее
+                    node = _mode == KeyMode::Multi ? node->left : nullptr;
+                }
+                if (node) {
+                    __builtin_prefetch(node);
+                    ++active;
+                }
+                nodes[j] = node;
+            }
+        }
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::equalRange(const K& key) -> std::pair<Iterator, Iterator> {
+    Node *first = find_node(key);
+    if (!first) {
+        return std::make_pair(end(), end());
+    }
+    return std::make_pair(Iterator(first), Iterator(upper_bound_node(key)));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::equalRange(const K& key) const -> std::pair<ConstIterator, ConstIterator> {
+    Node *first = find_node(key);
+    if (!first) {
+        return std::make_pair(cend(), cend());
+    }
+    return std::make_pair(ConstIterator(first), ConstIterator(upper_bound_node(key)));
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::min() const -> ConstIterator {
+#ifdef BST_THREADED
+    return ConstIterator(_first);
+#else
+    if (!_root) return cend();
+    
+    const Node* current = _root;
+    while (current->left) {
+        current = current->left;
+    }
+    return ConstIterator(current);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::max() const -> ConstIterator {
+#ifdef BST_THREADED
+    return ConstIterator(_last);
+#else
+    if (!_root) return cend();
+    
+    const Node* current = _root;
+    while (current->right) {
+        current = current->right;
+    }
+    return ConstIterator(current);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::min(const K& key) const -> ConstIterator {
+    // Повторы ключа упорядочены по значению, первый из них - наименьший
+    return find(key);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::max(const K& key) const -> ConstIterator {
+    if (_mode == KeyMode::Unique) return find(key);
+    if (!find_node(key)) return cend();
+    // Последний из повторов стоит перед первым большим ключем
+    Node *after = upper_bound_node(key);
+    if (!after) return max();
+    ConstIterator last(after);
+    return --last;
+}
+
+#ifdef BST_ORDER_STATISTICS
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::rank(const K& key) const {
+    size_t result = 0;
+    Node *current = _root;
+    while (current) {
+        if (less(current->keyValuePair.first, key)) {
+            // Левое поддерево и сам узел лежат левее key
+            result += 1 + (current->left ? current->left->count : 0);
+            current = current->right;
+        } else {
+            current = current->left;
+        }
+    }
+    return result;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::select(size_t k) const -> ConstIterator {
+    if (k >= _size) return cend();
+    Node *current = _root;
+    while (current) {
+        size_t left = current->left ? current->left->count : 0;
+        if (k < left) {
+            current = current->left;
+        } else if (k == left) {
+            break;
+        } else {
+            k -= left + 1;
+            current = current->right;
+        }
+    }
+    return ConstIterator(current);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::count_range(const K& lo, const K& hi) const {
+    if (!less(lo, hi)) return 0;
+    return rank(hi) - rank(lo);
+}
+#endif
+
+#ifdef BST_RANGE_AGGREGATES
+/*!***********************************************************
+Спуск до первого узла с ключем из [lo, hi), затем два спуска
+по границам: на левой границе берётся каждый узел не меньше lo
+вместе с его правым поддеревом, на правой - каждый узел меньше
+hi вместе с левым поддеревом. Поддеревья целиком учитываются
+по готовым агрегатам.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::range_aggregate(const K& lo, const K& hi) const -> Aggregate {
+    static_assert(aggregated, "range_aggregate требует арифметических значений");
+    Aggregate result;
+    if (!less(lo, hi)) return result;
+    Node *split = _root;
+    while (split && (less(split->keyValuePair.first, lo) || !less(split->keyValuePair.first, hi))) {
+        split = less(split->keyValuePair.first, lo) ? split->right : split->left;
+    }
+    if (!split) return result;
+    result.add(split->keyValuePair.second);
+
+    for (Node *node = split->left; node;) {
+        if (less(node->keyValuePair.first, lo)) {
+            node = node->right;
+        } else {
+            result.add(node->keyValuePair.second);
+            if (node->right) result.merge(node->right->aggregate);
+            node = node->left;
+        }
+    }
+    for (Node *node = split->right; node;) {
+        if (less(node->keyValuePair.first, hi)) {
+            result.add(node->keyValuePair.second);
+            if (node->left) result.merge(node->left->aggregate);
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return result;
+}
+#endif
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::begin() -> Iterator {
+#ifdef BST_THREADED
+    return Iterator(_first);
+#else
+    if (!_root) return end();
+    
+    Node* current = _root;
+    while (current->left) {
+        current = current->left;
+    }
+    return Iterator(current);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::end() -> Iterator {
+    return Iterator(nullptr);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::cbegin() const -> ConstIterator {
+#ifdef BST_THREADED
+    return ConstIterator(_first);
+#else
+    if (!_root) return cend();
+    
+    const Node* current = _root;
+    while (current->left) {
+        current = current->left;
+    }
+    return ConstIterator(current);
+#endif
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+auto BasicBinarySearchTree<K, V, Compare, Alloc>::cend() const -> ConstIterator {
+    return ConstIterator(nullptr);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::size() const {
+    return _size;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::output_tree() {
+    if (_root) {
+        _root->output_node_tree();
+    }
+    std::cout << std::endl;
+}
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::bytes_reserved() const {
+    return _pool.bytes_reserved();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+Alloc BasicBinarySearchTree<K, V, Compare, Alloc>::get_allocator() const {
+    return Alloc(_pool.get_allocator());
+}
+
+#ifdef BST_FIND_CACHE
+template <typename K, typename V, typename Compare, typename Alloc>
+FindCacheStats BasicBinarySearchTree<K, V, Compare, Alloc>::find_cache_stats() const {
+    return _find_cache.stats();
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::reset_find_cache_stats() {
+    _find_cache.reset_stats();
+}
+#endif
+
+#ifdef BST_STATS
+template <typename K, typename V, typename Compare, typename Alloc>
+TreeStats BasicBinarySearchTree<K, V, Compare, Alloc>::stats() const {
+    TreeStats stats;
+    _stats.copy_to(stats);
+    stats.size = _size;
+    stats.black_height = black_height(_root);
+    stats.height_bound = 2 * stats.black_height;
+    stats.bytes_reserved = bytes_reserved();
+    return stats;
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+void BasicBinarySearchTree<K, V, Compare, Alloc>::reset_stats() {
+    _stats.reset();
+}
+#endif
+
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::max_height() const {
+    return compute_height(_root);
+}
+
+template <typename K, typename V, typename Compare, typename Alloc>
+size_t BasicBinarySearchTree<K, V, Compare, Alloc>::compute_height(Node* node) const {
+    // Обход в глубину с явным стеком: в стеке не больше двух узлов на уровень
+    std::vector<std::pair<const Node*, size_t>> stack;
+    if (node) stack.emplace_back(node, 1);
+    size_t height = 0;
+    while (!stack.empty()) {
+        auto [current, depth] = stack.back();
+        stack.pop_back();
+        height = std::max(height, depth);
+        if (current->right) stack.emplace_back(current->right, depth + 1);
+        if (current->left) stack.emplace_back(current->left, depth + 1);
+    }
+    return height;
+}
@@ -0,0 +1,435 @@
+#include "CompactTree.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+CompactTree::CompactTree(CompactTree&& other) noexcept
+    : _nodes(std::move(other._nodes)), _root(other._root), _free(other._free), _size(other._size) {
+    other._nodes.clear();
+    other._root = other._free = NIL;
+    other._size = 0;
+}
+
+CompactTree& CompactTree::operator=(CompactTree&& other) noexcept {
+    if (this != &other) {
+        _nodes = std::move(other._nodes);
+        _root = other._root;
+        _free = other._free;
+        _size = other._size;
+        other._nodes.clear();
+        other._root = other._free = NIL;
+        other._size = 0;
+    }
+    return *this;
+}
+
+void CompactTree::set_red(Index i, bool red) {
+    if (red) {
+        _nodes[i].parent &= ~COLOR_BIT;
+    } else {
+        _nodes[i].parent |= COLOR_BIT;
+    }
+}
+
+CompactTree::Index* CompactTree::link_of(Index h) {
+    Index p = parent_of(h);
+    if (p == NIL) return &_root;
+    return left_of(p) == h ? &_nodes[p].left : &_nodes[p].right;
+}
+
+CompactTree::Index CompactTree::min_index(Index h) const {
+    while (left_of(h) != NIL) h = left_of(h);
+    return h;
+}
+
+CompactTree::Index CompactTree::max_index(Index h) const {
+    while (right_of(h) != NIL) h = right_of(h);
+    return h;
+}
+
+CompactTree::Index CompactTree::next(Index i) const {
+    if (right_of(i) != NIL) return min_index(right_of(i));
+    Index p = parent_of(i);
+    while (p != NIL && i == right_of(p)) {
+        i = p;
+        p = parent_of(p);
+    }
+    return p;
+}
+
+CompactTree::Index CompactTree::prev(Index i) const {
+    if (left_of(i) != NIL) return max_index(left_of(i));
+    Index p = parent_of(i);
+    while (p != NIL && i == left_of(p)) {
+        i = p;
+        p = parent_of(p);
+    }
+    return p;
+}
+
+CompactTree::Index CompactTree::create_node(const Key& key, const Value& value, Index parent) {
+    Index i = _free;
+    if (i != NIL) {
+        _free = _nodes[i].left;
+        _nodes[i] = Node{{key, value}, NIL, NIL, parent};
+    } else {
+        if (_nodes.size() >= NIL) throw std::length_error("CompactTree: превышено число узлов");
+        i = Index(_nodes.size());
+        _nodes.push_back(Node{{key, value}, NIL, NIL, parent});
+    }
+    return i;
+}
+
+void CompactTree::destroy_node(Index i) {
+    _nodes[i].left = _free;
+    _free = i;
+}
+
+CompactTree::Index CompactTree::rotate_left(Index h) {
+    Index x = right_of(h);
+    _nodes[h].right = left_of(x);
+    if (left_of(x) != NIL) set_parent(left_of(x), h);
+    _nodes[x].left = h;
+    set_red(x, isRed(h));
+    set_red(h, true);
+    set_parent(x, parent_of(h));
+    set_parent(h, x);
+    return x;
+}
+
+CompactTree::Index CompactTree::rotate_right(Index h) {
+    Index x = left_of(h);
+    _nodes[h].left = right_of(x);
+    if (right_of(x) != NIL) set_parent(right_of(x), h);
+    _nodes[x].right = h;
+    set_red(x, isRed(h));
+    set_red(h, true);
+    set_parent(x, parent_of(h));
+    set_parent(h, x);
+    return x;
+}
+
+void CompactTree::flip_colors(Index h) {
+    set_red(h, !isRed(h));
+    if (left_of(h) != NIL) set_red(left_of(h), !isRed(left_of(h)));
+    if (right_of(h) != NIL) set_red(right_of(h), !isRed(right_of(h)));
+}
+
+CompactTree::Index CompactTree::move_red_left(Index h) {
+    flip_colors(h);
+    if (isRed(left_of(right_of(h)))) {
+        _nodes[h].right = rotate_right(right_of(h));
+        h = rotate_left(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+CompactTree::Index CompactTree::move_red_right(Index h) {
+    flip_colors(h);
+    if (isRed(left_of(left_of(h)))) {
+        h = rotate_right(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+CompactTree::Index CompactTree::fix_up(Index h) {
+    if (isRed(right_of(h))) h = rotate_left(h);
+    if (isRed(left_of(h)) && isRed(left_of(left_of(h)))) h = rotate_right(h);
+    if (isRed(left_of(h)) && isRed(right_of(h))) flip_colors(h);
+    return h;
+}
+
+//! См. BinarySearchTree::fix_insert
+void CompactTree::fix_insert(Index h) {
+    while (h != NIL) {
+        Index parent = parent_of(h);
+        Index *link = link_of(h);
+        Index top = h;
+        bool flipped = false;
+        if (isRed(right_of(top)) && !isRed(left_of(top))) top = rotate_left(top);
+        if (isRed(left_of(top)) && isRed(left_of(left_of(top)))) top = rotate_right(top);
+        if (isRed(left_of(top)) && isRed(right_of(top))) {
+            flip_colors(top);
+            flipped = true;
+        }
+        *link = top;
+        if (top == h && !flipped && !isRed(h)) break;
+        h = parent;
+    }
+}
+
+void CompactTree::insert(const Key& key, const Value& value) {
+    Index parent = NIL;
+    Index h = _root;
+    bool to_left = false;
+    while (h != NIL) {
+        parent = h;
+        if (key < key_of(h)) {
+            h = left_of(h);
+            to_left = true;
+        } else if (key > key_of(h)) {
+            h = right_of(h);
+            to_left = false;
+        } else {
+            _nodes[h].keyValuePair.second = value;
+            return;
+        }
+    }
+    // create_node может переложить массив, поэтому ссылку на место вставки берём после
+    Index node = create_node(key, value, parent);
+    if (parent == NIL) {
+        _root = node;
+    } else if (to_left) {
+        _nodes[parent].left = node;
+    } else {
+        _nodes[parent].right = node;
+    }
+    _size++;
+    fix_insert(parent);
+    set_red(_root, false);
+}
+
+void CompactTree::erase(const Key& key) {
+    if (find_index(key) == NIL) return;
+    if (!isRed(left_of(_root)) && !isRed(right_of(_root))) set_red(_root, true);
+    erase_rb(key);
+    if (_root != NIL) set_red(_root, false);
+    _size--;
+}
+
+//! См. BinarySearchTree::erase_rb
+void CompactTree::erase_rb(const Key& key) {
+    Index h = _root;
+    bool erase_min = false;
+    while (true) {
+        if (erase_min || key < key_of(h)) {
+            if (erase_min && left_of(h) == NIL) break;
+            if (!isRed(left_of(h)) && !isRed(left_of(left_of(h)))) {
+                Index *link = link_of(h);
+                *link = h = move_red_left(h);
+            }
+            h = left_of(h);
+            continue;
+        }
+        if (isRed(left_of(h))) {
+            Index *link = link_of(h);
+            *link = h = rotate_right(h);
+        }
+        if (key == key_of(h) && right_of(h) == NIL) break;
+        if (!isRed(right_of(h)) && !isRed(left_of(right_of(h)))) {
+            Index *link = link_of(h);
+            *link = h = move_red_right(h);
+        }
+        if (key == key_of(h)) {
+            _nodes[h].keyValuePair = _nodes[min_index(right_of(h))].keyValuePair;
+            erase_min = true;
+        }
+        h = right_of(h);
+    }
+
+    Index parent = parent_of(h);
+    *link_of(h) = NIL;
+    destroy_node(h);
+    while (parent != NIL) {
+        Index up = parent_of(parent);
+        Index *link = link_of(parent);
+        *link = fix_up(parent);
+        parent = up;
+    }
+}
+
+CompactTree::Index CompactTree::find_index(const Key& key) const {
+    Index current = _root;
+    while (current != NIL) {
+        const Node &node = _nodes[current];
+        if (key < node.keyValuePair.first) {
+            current = node.left;
+        } else if (key > node.keyValuePair.first) {
+            current = node.right;
+        } else {
+            return current;
+        }
+    }
+    return NIL;
+}
+
+CompactTree::ConstIterator CompactTree::find(const Key& key) const {
+    return ConstIterator(this, find_index(key));
+}
+
+CompactTree::Iterator CompactTree::find(const Key& key) {
+    return Iterator(this, find_index(key));
+}
+
+std::pair<CompactTree::Iterator, CompactTree::Iterator> CompactTree::equalRange(const Key& key) {
+    Index first = find_index(key);
+    if (first == NIL) return std::make_pair(end(), end());
+    return std::make_pair(Iterator(this, first), Iterator(this, next(first)));
+}
+
+std::pair<CompactTree::ConstIterator, CompactTree::ConstIterator> CompactTree::equalRange(const Key& key) const {
+    Index first = find_index(key);
+    if (first == NIL) return std::make_pair(cend(), cend());
+    return std::make_pair(ConstIterator(this, first), ConstIterator(this, next(first)));
+}
+
+CompactTree::ConstIterator CompactTree::min() const {
+    return ConstIterator(this, _root == NIL ? NIL : min_index(_root));
+}
+
+CompactTree::ConstIterator CompactTree::max() const {
+    return ConstIterator(this, _root == NIL ? NIL : max_index(_root));
+}
+
+CompactTree::ConstIterator CompactTree::min(const Key& key) const {
+    return find(key);
+}
+
+CompactTree::ConstIterator CompactTree::max(const Key& key) const {
+    return find(key);
+}
+
+CompactTree::Iterator CompactTree::begin() {
+    return Iterator(this, _root == NIL ? NIL : min_index(_root));
+}
+
+CompactTree::Iterator CompactTree::end() {
+    return Iterator(this, NIL);
+}
+
+CompactTree::ConstIterator CompactTree::cbegin() const {
+    return min();
+}
+
+CompactTree::ConstIterator CompactTree::cend() const {
+    return ConstIterator(this, NIL);
+}
+
+size_t CompactTree::size() const {
+    return _size;
+}
+
+void CompactTree::clear() {
+    _nodes.clear();
+    _root = _free = NIL;
+    _size = 0;
+}
+
+void CompactTree::reserve(size_t count) {
+    _nodes.reserve(count);
+}
+
+void CompactTree::output_tree() const {
+    for (Index i = _root == NIL ? NIL : min_index(_root); i != NIL; i = next(i)) {
+        std::cout << (isRed(i) ? "[R] " : "[B] ") << key_of(i) << " : " << _nodes[i].keyValuePair.second << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+size_t CompactTree::max_height() const {
+    std::vector<std::pair<Index, size_t>> stack;
+    if (_root != NIL) stack.emplace_back(_root, 1);
+    size_t height = 0;
+    while (!stack.empty()) {
+        auto [current, depth] = stack.back();
+        stack.pop_back();
+        height = std::max(height, depth);
+        if (right_of(current) != NIL) stack.emplace_back(right_of(current), depth + 1);
+        if (left_of(current) != NIL) stack.emplace_back(left_of(current), depth + 1);
+    }
+    return height;
+}
+
+size_t CompactTree::bytes_reserved() const {
+    return _nodes.capacity() * sizeof(Node);
+}
+
+CompactTree::Iterator::Iterator(CompactTree* tree, Index index) : _tree(tree), _index(index) {}
+
+std::pair<Key, Value>& CompactTree::Iterator::operator*() {
+    return _tree->_nodes[_index].keyValuePair;
+}
+
+const std::pair<Key, Value>& CompactTree::Iterator::operator*() const {
+    return _tree->_nodes[_index].keyValuePair;
+}
+
+std::pair<Key, Value>* CompactTree::Iterator::operator->() {
+    return &_tree->_nodes[_index].keyValuePair;
+}
+
+const std::pair<Key, Value>* CompactTree::Iterator::operator->() const {
+    return &_tree->_nodes[_index].keyValuePair;
+}
+
+CompactTree::Iterator CompactTree::Iterator::operator++() {
+    _index = _tree->next(_index);
+    return *this;
+}
+
+CompactTree::Iterator CompactTree::Iterator::operator++(int) {
+    Iterator temp = *this;
+    ++(*this);
+    return temp;
+}
+
+CompactTree::Iterator CompactTree::Iterator::operator--() {
+    _index = _tree->prev(_index);
+    return *this;
+}
+
+CompactTree::Iterator CompactTree::Iterator::operator--(int) {
+    Iterator temp = *this;
+    --(*this);
+    return temp;
+}
+
+bool CompactTree::Iterator::operator==(const Iterator& other) const {
+    return _index == other._index;
+}
+
+bool CompactTree::Iterator::operator!=(const Iterator& other) const {
+    return _index != other._index;
+}
+
+CompactTree::ConstIterator::ConstIterator(const CompactTree* tree, Index index) : _tree(tree), _index(index) {}
+
+const std::pair<Key, Value>& CompactTree::ConstIterator::operator*() const {
+    return _tree->_nodes[_index].keyValuePair;
+}
+
+const std::pair<Key, Value>* CompactTree::ConstIterator::operator->() const {
+    return &_tree->_nodes[_index].keyValuePair;
+}
+
+CompactTree::ConstIterator CompactTree::ConstIterator::operator++() {
+    _index = _tree->next(_index);
+    return *this;
+}
+
+CompactTree::ConstIterator CompactTree::ConstIterator::operator++(int) {
+    ConstIterator temp = *this;
+    ++(*this);
+    return temp;
+}
+
+CompactTree::ConstIterator CompactTree::ConstIterator::operator--() {
+    _index = _tree->prev(_index);
+    return *this;
+}
+
+CompactTree::ConstIterator CompactTree::ConstIterator::operator--(int) {
+    ConstIterator temp = *this;
+    --(*this);
+    return temp;
+}
+
+bool CompactTree::ConstIterator::operator==(const ConstIterator& other) const {
+    return _index == other._index;
+}
+
+bool CompactTree::ConstIterator::operator!=(const ConstIterator& other) const {
+    return _index != other._index;
+}
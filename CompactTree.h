@@ -0,0 +1,173 @@
+#pragma once
+
+#include <utility>
+#include <cstdint>
+#include <vector>
+
+#include "BST.h"
+
+/*!***********************************************************
+Компактный вариант LLRB-дерева с тем же интерфейсом, что и
+BinarySearchTree:
+  - все узлы лежат в одном непрерывном массиве
+  - узлы ссылаются друг на друга 32-битными индексами
+  - цвет хранится в старшем бите индекса родителя
+  - удалённые узлы переиспользуются через список свободных
+
+Узел занимает 32 байта вместо 48 у BinarySearchTree, два узла
+помещаются в одну кэш-линию. Итераторы хранят индекс узла,
+поэтому не теряют силу при росте массива.
+**************************************************************/
+class CompactTree
+{
+    using Index = uint32_t;
+    static constexpr Index NIL = 0x7FFFFFFF;     //!< отсутствующий узел
+    static constexpr Index COLOR_BIT = 0x80000000; //!< бит цвета в поле parent
+
+    struct Node
+    {
+        std::pair<Key, Value> keyValuePair; //!< Пара ключ - значение
+        Index left;   //!< левый потомок
+        Index right;  //!< правый потомок
+        Index parent; //!< родительский узел и цвет в старшем бите (1 - чёрный)
+    };
+
+public:
+    //! Конструктор по умолчанию
+    CompactTree() = default;
+    //! Конструктор копирования
+    explicit CompactTree(const CompactTree &other) = default;
+    //! Оператор присваивания копированием
+    CompactTree &operator=(const CompactTree &other) = default;
+    //! Конструктор перемещения
+    explicit CompactTree(CompactTree &&other) noexcept;
+    //! Оператор присваивания перемещением
+    CompactTree &operator=(CompactTree &&other) noexcept;
+    //! Деструктор
+    ~CompactTree() = default;
+
+    //! Итератор компактного дерева, обходит элементы по возрастанию ключа
+    class Iterator
+    {
+    public:
+        Iterator(CompactTree *tree, Index index);
+
+        std::pair<Key, Value> &operator*();
+        const std::pair<Key, Value> &operator*() const;
+
+        std::pair<Key, Value> *operator->();
+        const std::pair<Key, Value> *operator->() const;
+
+        Iterator operator++();
+        Iterator operator++(int);
+
+        Iterator operator--();
+        Iterator operator--(int);
+
+        bool operator==(const Iterator &other) const;
+        bool operator!=(const Iterator &other) const;
+
+    private:
+        CompactTree *_tree;
+        Index _index;
+    };
+
+    //! Константный итератор компактного дерева
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const CompactTree *tree, Index index);
+
+        const std::pair<Key, Value> &operator*() const;
+        const std::pair<Key, Value> *operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator &other) const;
+        bool operator!=(const ConstIterator &other) const;
+
+    private:
+        const CompactTree *_tree;
+        Index _index;
+    };
+
+    //! Вставить элемент с ключем key и значением value
+    void insert(const Key &key, const Value &value);
+    //! Удалить элемент с ключем key
+    void erase(const Key &key);
+    //! Найти элемент с ключем key
+    ConstIterator find(const Key &key) const;
+    //! Найти элемент с ключем key
+    Iterator find(const Key &key);
+
+    //! Найти все элементы с ключем key, см. BinarySearchTree::equalRange
+    std::pair<Iterator, Iterator> equalRange(const Key &key);
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key &key) const;
+
+    //! Получить итератор на элемент с наименьшим ключем в дереве
+    ConstIterator min() const;
+    //! Получить итератор на элемент с наибольшим ключем в дереве
+    ConstIterator max() const;
+    //! Получить итератор на элемент с ключем key с наименьшим значением
+    ConstIterator min(const Key &key) const;
+    //! Получить итератор на элемент с ключем key с наибольшим значением
+    ConstIterator max(const Key &key) const;
+
+    //! Получить итератор на первый элемент дерева
+    Iterator begin();
+    //! Получить итератор на элемент, следующий за последним
+    Iterator end();
+
+    //! Получить константный итератор на начало
+    ConstIterator cbegin() const;
+    //! Получить константный итератор на конец
+    ConstIterator cend() const;
+
+    //! Получить размер дерева
+    size_t size() const;
+    //! Удалить все элементы дерева
+    void clear();
+    //! Зарезервировать место под count узлов
+    void reserve(size_t count);
+    //! Вывести дерево в консоль
+    void output_tree() const;
+    //! Получить максимальную высоту в дереве
+    size_t max_height() const;
+    //! Сколько байт занимает массив узлов
+    size_t bytes_reserved() const;
+
+private:
+    Index left_of(Index i) const { return _nodes[i].left; }
+    Index right_of(Index i) const { return _nodes[i].right; }
+    Index parent_of(Index i) const { return _nodes[i].parent & ~COLOR_BIT; }
+    const Key &key_of(Index i) const { return _nodes[i].keyValuePair.first; }
+    bool isRed(Index i) const { return i != NIL && !(_nodes[i].parent & COLOR_BIT); }
+    void set_parent(Index i, Index p) { _nodes[i].parent = (_nodes[i].parent & COLOR_BIT) | p; }
+    void set_red(Index i, bool red);
+    Index *link_of(Index h);
+    Index next(Index i) const;
+    Index prev(Index i) const;
+    Index min_index(Index h) const;
+    Index max_index(Index h) const;
+
+    Index create_node(const Key &key, const Value &value, Index parent);
+    void destroy_node(Index i);
+    Index rotate_left(Index h);
+    Index rotate_right(Index h);
+    void flip_colors(Index h);
+    Index move_red_left(Index h);
+    Index move_red_right(Index h);
+    Index fix_up(Index h);
+    void fix_insert(Index h);
+    void erase_rb(const Key &key);
+    Index find_index(const Key &key) const;
+
+    std::vector<Node> _nodes; //!< все узлы дерева, включая свободные
+    Index _root = NIL;        //!< корневой узел дерева
+    Index _free = NIL;        //!< список свободных узлов (через поле left)
+    size_t _size = 0;         //!< размер дерева
+};
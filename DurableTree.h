@@ -0,0 +1,423 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+#include "WriteAheadLog.h"
+
+//! Настройки журнала BasicDurableTree
+struct WalOptions
+{
+    //! \brief Сколько записей копится в памяти до записи в журнал: при 1 каждая операция
+    //! дожидается fdatasync. При N > 1 операция, на которой незафиксированных записей
+    //! становится N, пишет их в журнал и ждёт fdatasync, остальные операции не ждут
+    //! \note Записи, добавленные во время fdatasync, ведущий фиксирует следующим заходом,
+    //! если их снова набралось N. При сбое теряются незафиксированные записи: меньше N
+    //! накопленных плюс добавленные во время идущего fdatasync
+    size_t sync_every = 1;
+    //! Вызывать ли fdatasync: без него записи переживают падение процесса, но не ОС
+    bool fsync = true;
+    //! Размер журнала в байтах, после которого запись делает контрольную точку; 0 - только checkpoint()
+    uint64_t checkpoint_bytes = 64u << 20;
+};
+
+/*!***********************************************************
+Дерево с журналом упреждающей записи в каталоге directory:
+  - каждая insert / erase дописывается в журнал wal.<g>.log
+    и применяется к дереву в памяти под одной блокировкой,
+    поэтому порядок записей в журнале совпадает с порядком
+    изменений дерева
+  - групповая фиксация: записью в файл и fdatasync занимается
+    один поток-ведущий за раз, без блокировки дерева. Записи,
+    которые другие потоки добавили за это время, уходят на диск
+    следующим ведущим одним fdatasync
+  - контрольная точка сохраняет дерево в snapshot.<g+1>.bst
+    (BinarySearchTree::save) и начинает пустой журнал поколения
+    g + 1, после чего файлы поколения g удаляются
+  - при открытии загружается снимок старшего поколения и
+    поверх него проигрывается журнал того же поколения;
+    оборванная запись в хвосте журнала отбрасывается
+
+Переименование снимка - момент фиксации контрольной точки:
+журнал нового поколения создаётся раньше, поэтому после сбоя
+в любой момент находится согласованная пара снимок - журнал.
+
+Поиски видят запись сразу после её применения, ещё до того,
+как она оказалась на диске. Контрольная точка держит блокировку,
+пока дерево записывается на диск. После ошибки записи журнала
+дерево перестаёт принимать изменения.
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>>
+class BasicDurableTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "log records store keys and values as raw bytes");
+
+    using Tree = BasicBinarySearchTree<K, V, Compare>;
+
+    static constexpr size_t RECORD_SIZE = wal::record_size(sizeof(K), sizeof(V));
+
+public:
+    //! \param directory каталог снимков и журналов (создаётся, если его нет)
+    //! \param mode режим ключей; должен совпадать с режимом сохранённого дерева
+    //! \param options настройки журнала
+    explicit BasicDurableTree(const std::string &directory, KeyMode mode = KeyMode::Unique,
+                              const WalOptions &options = WalOptions());
+    //! Дописывает накопленные записи в журнал
+    ~BasicDurableTree();
+
+    BasicDurableTree(const BasicDurableTree &) = delete;
+    BasicDurableTree &operator=(const BasicDurableTree &) = delete;
+
+    //! Вставить элемент, см. BinarySearchTree::insert
+    void insert(const K &key, const V &value);
+    //! Удалить все элементы с ключем key
+    void erase(const K &key);
+    //! Дождаться, пока все сделанные записи окажутся в журнале на диске
+    void flush();
+    //! Сохранить снимок дерева и начать пустой журнал
+    void checkpoint();
+
+    //! Значение первого элемента с ключем key или std::nullopt
+    std::optional<V> find(const K &key) const;
+    //! Есть ли элемент с ключем key
+    bool contains(const K &key) const;
+    //! Количество элементов
+    size_t size() const;
+
+    //! Сколько записей журнала проиграно при открытии
+    uint64_t replayed() const;
+    //! Сколько раз журнал записывался на диск (групповых фиксаций)
+    uint64_t commits() const;
+
+private:
+    void write(wal::Op op, const K &key, const V &value);
+    void commit(std::unique_lock<std::mutex> &guard, uint64_t lsn);
+    void flush_locked(std::unique_lock<std::mutex> &guard);
+    void checkpoint_locked(std::unique_lock<std::mutex> &guard);
+    void check_failed() const;
+
+    void recover();
+    void replay(const std::string &path);
+    void remove_stale() const;
+    std::string snapshot_path(uint64_t generation) const;
+    std::string log_path(uint64_t generation) const;
+    static bool parse_generation(const std::string &name, const std::string &prefix, const std::string &suffix,
+                                 uint64_t &generation);
+
+    std::string _directory;
+    WalOptions _options;
+
+    mutable std::mutex _lock;         //!< дерево, буфер записей и счётчики
+    std::condition_variable _synced;  //!< ведущий закончил запись
+    Tree _tree;
+    wal::LogFile _log;
+    std::vector<unsigned char> _buffer; //!< записи, ещё не отданные в журнал
+    std::vector<unsigned char> _batch;  //!< записи, которые пишет ведущий
+    uint64_t _appended = 0;   //!< номер последней записи
+    uint64_t _durable = 0;    //!< номер последней записи на диске
+    bool _syncing = false;    //!< есть ведущий
+    bool _failed = false;     //!< запись журнала не удалась
+    uint64_t _generation = 0; //!< поколение текущих снимка и журнала
+    uint64_t _log_bytes = 0;  //!< размер записей в журнале текущего поколения
+    uint64_t _replayed = 0;
+    uint64_t _commits = 0;
+};
+
+//! Дерево с журналом, ключи Key и значения Value
+using DurableTree = BasicDurableTree<Key, Value>;
+
+template <typename K, typename V, typename Compare>
+BasicDurableTree<K, V, Compare>::BasicDurableTree(const std::string &directory, KeyMode mode,
+                                                  const WalOptions &options)
+    : _directory(directory), _options(options), _tree(mode) {
+    std::filesystem::create_directories(_directory);
+    recover();
+}
+
+template <typename K, typename V, typename Compare>
+BasicDurableTree<K, V, Compare>::~BasicDurableTree() {
+    try {
+        flush();
+    } catch (...) {
+        // Деструктор не бросает: записи после ошибки и так не попадут на диск
+    }
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::insert(const K &key, const V &value) {
+    write(wal::Op::Insert, key, value);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::erase(const K &key) {
+    write(wal::Op::Erase, key, V());
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::write(wal::Op op, const K &key, const V &value) {
+    std::unique_lock<std::mutex> guard(_lock);
+    check_failed();
+    size_t offset = _buffer.size();
+    _buffer.resize(offset + RECORD_SIZE);
+    unsigned char *record = _buffer.data() + offset;
+    record[0] = uint8_t(op);
+    std::memcpy(record + 1, &key, sizeof(K));
+    std::memcpy(record + 1 + sizeof(K), &value, sizeof(V));
+    uint32_t sum = wal::record_checksum(record, RECORD_SIZE);
+    std::memcpy(record + RECORD_SIZE - sizeof(sum), &sum, sizeof(sum));
+    uint64_t lsn = ++_appended;
+    _log_bytes += RECORD_SIZE;
+
+    if (op == wal::Op::Insert) {
+        _tree.insert(key, value);
+    } else {
+        _tree.erase(key);
+    }
+
+    if (_options.sync_every <= 1) {
+        commit(guard, lsn);
+    } else if (lsn - _durable >= _options.sync_every && !_syncing) {
+        commit(guard, lsn);
+    }
+    if (_options.checkpoint_bytes && _log_bytes >= _options.checkpoint_bytes) checkpoint_locked(guard);
+}
+
+/*!***********************************************************
+Дождаться, пока запись номер lsn окажется в журнале. Если никто
+не пишет журнал, поток становится ведущим: забирает все
+накопленные записи, пишет их без блокировки и будит ожидающих.
+При sync_every > 1 ведущий остаётся ведущим, пока за время его
+записи снова накопилось sync_every записей: write() в это время
+их не фиксирует, и без этого они ждали бы следующей операции.
+**************************************************************/
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::commit(std::unique_lock<std::mutex> &guard, uint64_t lsn) {
+    bool led = false;
+    auto backlog = [&] {
+        return led && _options.sync_every > 1 && _appended - _durable >= _options.sync_every;
+    };
+    while (_durable < lsn || backlog()) {
+        check_failed();
+        if (_syncing) {
+            _synced.wait(guard);
+            continue;
+        }
+        _syncing = true;
+        led = true;
+        uint64_t upto = _appended;
+        _buffer.swap(_batch);
+        guard.unlock();
+        std::exception_ptr error;
+        try {
+            _log.append(_batch.data(), _batch.size());
+            if (_options.fsync) _log.sync();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        guard.lock();
+        _batch.clear();
+        _syncing = false;
+        if (error) {
+            _failed = true;
+        } else {
+            _durable = upto;
+            ++_commits;
+        }
+        _synced.notify_all();
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::flush_locked(std::unique_lock<std::mutex> &guard) {
+    // Пока ведущий пишет, другие потоки могут добавить ещё записей
+    while (_durable < _appended) commit(guard, _appended);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::flush() {
+    std::unique_lock<std::mutex> guard(_lock);
+    flush_locked(guard);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::checkpoint() {
+    std::unique_lock<std::mutex> guard(_lock);
+    check_failed();
+    checkpoint_locked(guard);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::checkpoint_locked(std::unique_lock<std::mutex> &guard) {
+    flush_locked(guard);
+    // Блокировка не отпускалась с конца flush_locked: ведущего нет, журнал целиком на диске
+    uint64_t next = _generation + 1;
+    wal::LogFile log = wal::LogFile::create(log_path(next), wal::make_header(sizeof(K), sizeof(V), uint32_t(_tree.key_mode())));
+    _tree.save(snapshot_path(next));
+    wal::sync_directory(_directory);
+
+    _log = std::move(log);
+    std::remove(snapshot_path(_generation).c_str());
+    std::remove(log_path(_generation).c_str());
+    _generation = next;
+    _log_bytes = 0;
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::check_failed() const {
+    if (_failed) throw std::runtime_error("DurableTree: запись журнала не удалась, изменения не принимаются");
+}
+
+template <typename K, typename V, typename Compare>
+std::optional<V> BasicDurableTree<K, V, Compare>::find(const K &key) const {
+    std::lock_guard<std::mutex> guard(_lock);
+    auto it = _tree.find(key);
+    if (it == _tree.cend()) return std::nullopt;
+    return it->second;
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicDurableTree<K, V, Compare>::contains(const K &key) const {
+    return find(key).has_value();
+}
+
+template <typename K, typename V, typename Compare>
+size_t BasicDurableTree<K, V, Compare>::size() const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _tree.size();
+}
+
+template <typename K, typename V, typename Compare>
+uint64_t BasicDurableTree<K, V, Compare>::replayed() const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _replayed;
+}
+
+template <typename K, typename V, typename Compare>
+uint64_t BasicDurableTree<K, V, Compare>::commits() const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _commits;
+}
+
+//! Загрузить снимок старшего поколения, проиграть его журнал и удалить устаревшие файлы
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::recover() {
+    bool have_snapshot = false;
+    for (const auto &entry : std::filesystem::directory_iterator(_directory)) {
+        uint64_t generation;
+        if (parse_generation(entry.path().filename().string(), "snapshot.", ".bst", generation) &&
+            (!have_snapshot || generation > _generation)) {
+            _generation = generation;
+            have_snapshot = true;
+        }
+    }
+    if (have_snapshot) {
+        KeyMode mode = _tree.key_mode();
+        _tree.load(snapshot_path(_generation));
+        if (_tree.key_mode() != mode) throw std::runtime_error("DurableTree: режим ключей снимка не совпадает");
+    }
+
+    std::string path = log_path(_generation);
+    if (std::filesystem::exists(path)) {
+        replay(path);
+    } else {
+        _log = wal::LogFile::create(path, wal::make_header(sizeof(K), sizeof(V), uint32_t(_tree.key_mode())));
+        wal::sync_directory(_directory);
+    }
+    remove_stale();
+}
+
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::replay(const std::string &path) {
+    uint64_t valid_end;
+    uint64_t file_size;
+    {
+        tree_file::MappedFile file = tree_file::MappedFile::open(path);
+        const wal::Header &header = wal::check_header(file, sizeof(K), sizeof(V));
+        if (header.key_mode != uint32_t(_tree.key_mode())) {
+            throw std::runtime_error("DurableTree: режим ключей журнала не совпадает");
+        }
+        file.advise(MADV_SEQUENTIAL);
+        uint64_t offset = sizeof(wal::Header);
+        for (; offset + RECORD_SIZE <= file.size(); offset += RECORD_SIZE) {
+            const unsigned char *record = file.data() + offset;
+            uint32_t sum;
+            std::memcpy(&sum, record + RECORD_SIZE - sizeof(sum), sizeof(sum));
+            if (sum != wal::record_checksum(record, RECORD_SIZE)) break;
+            K key;
+            V value;
+            std::memcpy(&key, record + 1, sizeof(K));
+            std::memcpy(&value, record + 1 + sizeof(K), sizeof(V));
+            if (record[0] == uint8_t(wal::Op::Insert)) {
+                _tree.insert(key, value);
+            } else if (record[0] == uint8_t(wal::Op::Erase)) {
+                _tree.erase(key);
+            } else {
+                break;
+            }
+            ++_replayed;
+        }
+        valid_end = offset;
+        file_size = file.size();
+    }
+    _log = wal::LogFile::open(path);
+    // Оборванный хвост отрезается, иначе новые записи легли бы после него
+    if (valid_end < file_size) {
+        _log.truncate(valid_end);
+        _log.sync();
+    }
+    _log_bytes = valid_end - sizeof(wal::Header);
+}
+
+//! Удалить снимки и журналы других поколений и недописанные временные файлы
+template <typename K, typename V, typename Compare>
+void BasicDurableTree<K, V, Compare>::remove_stale() const {
+    std::vector<std::filesystem::path> stale;
+    for (const auto &entry : std::filesystem::directory_iterator(_directory)) {
+        std::string name = entry.path().filename().string();
+        uint64_t generation;
+        bool ours = parse_generation(name, "snapshot.", ".bst", generation) ||
+                    parse_generation(name, "wal.", ".log", generation);
+        bool temporary = parse_generation(name, "snapshot.", ".bst.tmp", generation) ||
+                         parse_generation(name, "wal.", ".log.tmp", generation);
+        if (temporary || (ours && generation != _generation)) stale.push_back(entry.path());
+    }
+    for (const auto &path : stale) std::filesystem::remove(path);
+}
+
+template <typename K, typename V, typename Compare>
+std::string BasicDurableTree<K, V, Compare>::snapshot_path(uint64_t generation) const {
+    return (std::filesystem::path(_directory) / ("snapshot." + std::to_string(generation) + ".bst")).string();
+}
+
+template <typename K, typename V, typename Compare>
+std::string BasicDurableTree<K, V, Compare>::log_path(uint64_t generation) const {
+    return (std::filesystem::path(_directory) / ("wal." + std::to_string(generation) + ".log")).string();
+}
+
+//! Разобрать имя вида prefix<число>suffix
+template <typename K, typename V, typename Compare>
+bool BasicDurableTree<K, V, Compare>::parse_generation(const std::string &name, const std::string &prefix,
+                                                       const std::string &suffix, uint64_t &generation) {
+    if (name.size() <= prefix.size() + suffix.size()) return false;
+    if (name.compare(0, prefix.size(), prefix) != 0) return false;
+    if (name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) return false;
+    std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (digits.find_first_not_of("0123456789") != std::string::npos || digits.size() > 19) return false;
+    generation = std::stoull(digits);
+    return true;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/*!***********************************************************
+Эпохи для безопасного освобождения памяти, которую читают без
+блокировок (один домен на процесс, EpochDomain::global()):
+  - читатель на время чтения открывает Guard, и его поток
+    отмечает в своей ячейке текущую эпоху
+  - писатель сначала убирает объект из общего доступа (подменяет
+    указатель), затем вызывает synchronize(): она сдвигает эпоху
+    и ждёт, пока все читатели, вошедшие до сдвига, выйдут. После
+    этого объект можно освобождать
+
+Ячейки потоков лежат каждая в своей кэш-линии, поэтому вход и
+выход читателя не трогают общих для потоков линий. Ячейка
+закрепляется за потоком при первом Guard и освобождается при
+завершении потока. Если ячеек не хватило, Guard неактивен, и
+читатель должен пойти по пути с блокировкой.
+**************************************************************/
+class EpochDomain
+{
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch{0}; //!< эпоха входа читателя, 0 - вне чтения
+        std::atomic<bool> owned{false}; //!< ячейка закреплена за потоком
+    };
+
+public:
+    //! Сколько потоков одновременно могут читать без блокировки
+    static constexpr size_t max_readers = 128;
+
+    //! Домен эпох процесса
+    static EpochDomain &global();
+
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    //! \brief Отметка читателя: пока объект жив, synchronize() его ждёт
+    //! \note Вложенные Guard одного потока разрешены, отметку снимает внешний
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        //! Удалось ли отметиться (false - ячейки кончились)
+        explicit operator bool() const { return _slot != nullptr; }
+
+    private:
+        Slot *_slot = nullptr;
+    };
+
+    //! Дождаться выхода всех читателей, вошедших до вызова
+    void synchronize();
+
+private:
+    EpochDomain() = default;
+
+    //! Состояние потока: его ячейка и глубина вложенных Guard
+    struct ThreadState
+    {
+        Slot *slot = nullptr;
+        bool tried = false; //!< ячейку уже пытались получить
+        unsigned depth = 0;
+        ~ThreadState() {
+            if (slot) slot->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    static ThreadState &thread_state();
+    Slot *acquire_slot();
+
+    alignas(64) std::atomic<uint64_t> _epoch{1}; //!< текущая эпоха
+    Slot _slots[max_readers];
+};
+
+inline EpochDomain &EpochDomain::global() {
+    static EpochDomain domain;
+    return domain;
+}
+
+inline auto EpochDomain::thread_state() -> ThreadState & {
+    static thread_local ThreadState state;
+    return state;
+}
+
+inline auto EpochDomain::acquire_slot() -> Slot * {
+    for (Slot &slot : _slots) {
+        bool expected = false;
+        if (!slot.owned.load(std::memory_order_relaxed) &&
+            slot.owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+inline EpochDomain::Guard::Guard() {
+    ThreadState &state = thread_state();
+    if (!state.tried) {
+        state.tried = true;
+        state.slot = global().acquire_slot();
+    }
+    if (!state.slot) return;
+    if (state.depth++ == 0) {
+        // Всё seq_cst: отметка должна стать видна раньше, чем читатель загрузит
+        // общий указатель, иначе synchronize() может её пропустить
+        state.slot->epoch.store(global()._epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+    _slot = state.slot;
+}
+
+inline EpochDomain::Guard::~Guard() {
+    if (!_slot) return;
+    if (--thread_state().depth == 0) _slot->epoch.store(0, std::memory_order_release);
+}
+
+inline void EpochDomain::synchronize() {
+    uint64_t target = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    for (Slot &slot : _slots) {
+        for (;;) {
+            uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+            if (epoch == 0 || epoch >= target) break;
+            std::this_thread::yield();
+        }
+    }
+}
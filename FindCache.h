@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//! Попадания и промахи кэша поиска, см. BasicBinarySearchTree::find_cache_stats()
+struct FindCacheStats
+{
+    uint64_t hits = 0;   //!< поисков, найденных в кэше
+    uint64_t misses = 0; //!< поисков, спустившихся по дереву
+
+    //! Доля попаданий среди всех поисков
+    double hit_rate() const { return hits + misses ? double(hits) / double(hits + misses) : 0; }
+};
+
+/*!***********************************************************
+Кэш узлов перед поиском по дереву (только при сборке с
+BST_FIND_CACHE): Sets наборов по два указателя на узел,
+набор выбирается по хешу ключа.
+  - в кэше лежат только указатели: ключ сверяется по самому
+    узлу, поэтому неверное попадание невозможно, пока каждый
+    разрушаемый узел убирается из кэша через erase()
+  - новый узел встаёт во второй путь набора и поднимается в
+    первый только при повторном попадании: редкие ключи сменяют
+    друг друга во втором пути и не вытесняют горячий из первого
+  - указатели атомарные, порядок памяти relaxed: константный
+    find() может идти из нескольких потоков, дерево при этом не
+    меняется, а гонка двух записей в набор только вытесняет узел
+Счётчики попаданий и промахов ведутся без атомарного сложения,
+при параллельных читателях часть отсчётов может потеряться.
+**************************************************************/
+template <typename Node, size_t Sets = 1024>
+class FindCache
+{
+    static_assert(Sets >= 2 && (Sets & (Sets - 1)) == 0, "number of sets must be a power of two, at least 2");
+
+public:
+    FindCache() = default;
+    FindCache(const FindCache &) = delete;
+    FindCache &operator=(const FindCache &) = delete;
+
+    //! Узел из набора хеша hash, для которого matches(node) истинно, или nullptr
+    template <typename Matches>
+    Node *find(size_t hash, Matches &&matches) {
+        std::atomic<Node *> *set = set_of(hash);
+        Node *first = set[0].load(std::memory_order_relaxed);
+        if (first && matches(first)) {
+            count(_hits);
+            return first;
+        }
+        Node *second = set[1].load(std::memory_order_relaxed);
+        if (second && matches(second)) {
+            set[1].store(first, std::memory_order_relaxed);
+            set[0].store(second, std::memory_order_relaxed);
+            count(_hits);
+            return second;
+        }
+        count(_misses);
+        return nullptr;
+    }
+
+    //! Запомнить узел node в наборе хеша hash
+    void insert(size_t hash, Node *node) {
+        set_of(hash)[1].store(node, std::memory_order_relaxed);
+    }
+
+    //! Убрать узел node из набора хеша hash (вызывается до разрушения узла)
+    void erase(size_t hash, const Node *node) {
+        std::atomic<Node *> *set = set_of(hash);
+        for (size_t way = 0; way < 2; ++way) {
+            if (set[way].load(std::memory_order_relaxed) == node) set[way].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    //! Убрать все узлы: после освобождения пула целиком или передачи узлов другому дереву
+    void clear() {
+        for (auto &entry : _entries) entry.store(nullptr, std::memory_order_relaxed);
+    }
+
+    FindCacheStats stats() const {
+        return {_hits.load(std::memory_order_relaxed), _misses.load(std::memory_order_relaxed)};
+    }
+
+    void reset_stats() {
+        _hits.store(0, std::memory_order_relaxed);
+        _misses.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<Node *> *set_of(size_t hash) {
+        // Старшие биты произведения Фибоначчи: соседние ключи расходятся по разным наборам
+        constexpr unsigned shift = 64 - __builtin_ctzll(Sets);
+        return &_entries[2 * size_t((uint64_t(hash) * 0x9E3779B97F4A7C15ull) >> shift)];
+    }
+
+    static void count(std::atomic<uint64_t> &counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<Node *>, 2 * Sets> _entries{};
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+};
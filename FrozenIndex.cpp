@@ -0,0 +1,198 @@
+#include "FrozenIndex.h"
+#include <algorithm>
+#include <limits>
+#include <new>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FROZEN_INDEX_X86 1
+#endif
+
+namespace {
+
+constexpr size_t CACHE_LINE = 64;
+//! Столько ключей помещается в кэш-линию: потомки узла k через
+//! четыре уровня занимают ровно одну линию, начиная с 16k
+constexpr size_t PREFETCH_STRIDE = CACHE_LINE / sizeof(Key);
+constexpr size_t PREFETCH_LEVELS = 4;
+//! Сколько спусков find_many ведёт в ногу
+constexpr size_t GROUP = 16;
+static_assert(PREFETCH_STRIDE == size_t(1) << PREFETCH_LEVELS, "ключи должны быть 32-битными");
+
+//! Номер по возрастанию узла k совершенного дерева высоты levels
+size_t in_order_rank(size_t k, size_t levels) {
+    size_t depth = 63 - __builtin_clzll(k);
+    size_t position = k - (size_t(1) << depth);
+    return ((2 * position + 1) << (levels - 1 - depth)) - 1;
+}
+
+} // namespace
+
+void FrozenIndex::AlignedDelete::operator()(Key *keys) const {
+    ::operator delete[](keys, std::align_val_t(CACHE_LINE));
+}
+
+FrozenIndex::FrozenIndex(const BinarySearchTree &tree) {
+    _keys.reserve(tree.size());
+    _values.reserve(tree.size());
+    for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
+        _keys.push_back(it->first);
+        _values.push_back(it->second);
+    }
+
+    size_t capacity = 0;
+    while (capacity < _keys.size()) {
+        capacity = capacity * 2 + 1;
+        ++_levels;
+    }
+    _eytzinger.reset(static_cast<Key *>(
+        ::operator new[]((capacity + 1) * sizeof(Key), std::align_val_t(CACHE_LINE))));
+    _eytzinger[0] = Key();
+    // Хвост дополнен наибольшим ключом: он не меньше любого искомого,
+    // а среди равных ему найдётся первым настоящий элемент
+    for (size_t k = 1; k <= capacity; ++k) {
+        size_t rank = in_order_rank(k, _levels);
+        _eytzinger[k] = rank < _keys.size() ? _keys[rank] : std::numeric_limits<Key>::max();
+    }
+}
+
+//! Спуск по массиву Эйтцингера: шаг вправо - сравнение, а не переход
+template <bool Upper>
+size_t FrozenIndex::search(const Key &key) const {
+    const Key *keys = _eytzinger.get();
+    size_t k = 1;
+    size_t level = 0;
+    for (; level + PREFETCH_LEVELS < _levels; ++level) {
+        __builtin_prefetch(keys + k * PREFETCH_STRIDE);
+        k = 2 * k + (Upper ? keys[k] <= key : keys[k] < key);
+    }
+    for (; level < _levels; ++level) {
+        k = 2 * k + (Upper ? keys[k] <= key : keys[k] < key);
+    }
+    return finish_search(k);
+}
+
+//! Перевести лист, на котором закончился спуск, в позицию
+size_t FrozenIndex::finish_search(size_t k) const {
+    // Снять хвост шагов вправо и последний шаг влево: остаётся узел,
+    // в котором спуск последний раз повернул влево
+    k >>= __builtin_ctzll(~static_cast<unsigned long long>(k)) + 1;
+    if (k == 0) return size();
+    size_t rank = in_order_rank(k, _levels);
+    return rank < size() ? rank : size();
+}
+
+size_t FrozenIndex::lower_bound(const Key &key) const {
+    return search<false>(key);
+}
+
+size_t FrozenIndex::upper_bound(const Key &key) const {
+    return search<true>(key);
+}
+
+size_t FrozenIndex::find(const Key &key) const {
+    size_t pos = lower_bound(key);
+    return pos < size() && _keys[pos] == key ? pos : size();
+}
+
+std::pair<size_t, size_t> FrozenIndex::range(const Key &lo, const Key &hi) const {
+    if (!(lo < hi)) return {size(), size()};
+    return {lower_bound(lo), lower_bound(hi)};
+}
+
+void FrozenIndex::find_many_scalar(const Key *keys, size_t count, Value *out, bool *found) const {
+    const Key *tree = _eytzinger.get();
+    size_t k[GROUP];
+    for (size_t base = 0; base < count; base += GROUP) {
+        size_t group = std::min(GROUP, count - base);
+        const Key *probe = keys + base;
+        for (size_t j = 0; j < group; ++j) k[j] = 1;
+        for (size_t level = 0; level < _levels; ++level) {
+            // Пока считается остальная пачка, узел следующего уровня уже подгружается
+            bool last = level + 1 == _levels;
+            for (size_t j = 0; j < group; ++j) {
+                k[j] = 2 * k[j] + (tree[k[j]] < probe[j]);
+                if (!last) __builtin_prefetch(tree + k[j]);
+            }
+        }
+        for (size_t j = 0; j < group; ++j) {
+            size_t pos = finish_search(k[j]);
+            found[base + j] = pos < size() && _keys[pos] == probe[j];
+            if (found[base + j]) out[base + j] = _values[pos];
+        }
+    }
+}
+
+#ifdef FROZEN_INDEX_X86
+/*!***********************************************************
+Восемь спусков в одном регистре: узлы текущего уровня читаются
+одной командой gather, сравнение беззнаковых ключей сводится
+к знаковому через инверсию старшего бита, а 2k + (узел < ключ)
+считается как k + k - маска сравнения.
+**************************************************************/
+__attribute__((target("avx2")))
+void FrozenIndex::find_many_avx2(const Key *keys, size_t count, Value *out, bool *found) const {
+    const int *tree = reinterpret_cast<const int *>(_eytzinger.get());
+    const __m256i sign = _mm256_set1_epi32(int(0x80000000u));
+    const __m256i one = _mm256_set1_epi32(1);
+    constexpr size_t LANES = 8;
+    constexpr size_t VECTORS = 4;
+    constexpr size_t BATCH = VECTORS * LANES;
+    alignas(32) uint32_t leaf[BATCH];
+
+    size_t base = 0;
+    for (; base + BATCH <= count; base += BATCH) {
+        __m256i probe[VECTORS];
+        __m256i k[VECTORS];
+        for (size_t v = 0; v < VECTORS; ++v) {
+            probe[v] = _mm256_xor_si256(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + base + v * LANES)), sign);
+            k[v] = one;
+        }
+        for (size_t level = 0; level < _levels; ++level) {
+            bool last = level + 1 == _levels;
+            for (size_t v = 0; v < VECTORS; ++v) {
+                __m256i node = _mm256_xor_si256(_mm256_i32gather_epi32(tree, k[v], 4), sign);
+                __m256i less = _mm256_cmpgt_epi32(probe[v], node);
+                k[v] = _mm256_sub_epi32(_mm256_add_epi32(k[v], k[v]), less);
+                if (!last) {
+                    _mm256_store_si256(reinterpret_cast<__m256i *>(leaf + v * LANES), k[v]);
+                    for (size_t j = 0; j < LANES; ++j) __builtin_prefetch(tree + leaf[v * LANES + j]);
+                }
+            }
+        }
+        for (size_t v = 0; v < VECTORS; ++v) {
+            _mm256_store_si256(reinterpret_cast<__m256i *>(leaf + v * LANES), k[v]);
+        }
+        for (size_t j = 0; j < BATCH; ++j) {
+            const Key &key = keys[base + j];
+            size_t pos = finish_search(leaf[j]);
+            found[base + j] = pos < size() && _keys[pos] == key;
+            if (found[base + j]) out[base + j] = _values[pos];
+        }
+    }
+    find_many_scalar(keys + base, count - base, out + base, found + base);
+}
+#else
+void FrozenIndex::find_many_avx2(const Key *keys, size_t count, Value *out, bool *found) const {
+    find_many_scalar(keys, count, out, found);
+}
+#endif
+
+bool FrozenIndex::simd_available() {
+#ifdef FROZEN_INDEX_X86
+    static const bool available = __builtin_cpu_supports("avx2");
+    return available;
+#else
+    return false;
+#endif
+}
+
+void FrozenIndex::find_many(const Key *keys, size_t count, Value *out, bool *found) const {
+    // Индексы узлов в AVX2-ядре 32-битные: после спуска они не больше 2^(levels + 1)
+    if (simd_available() && _levels < 31) {
+        find_many_avx2(keys, count, out, found);
+    } else {
+        find_many_scalar(keys, count, out, found);
+    }
+}
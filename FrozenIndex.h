@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+
+/*!***********************************************************
+Неизменяемый индекс только для чтения, получаемый из дерева
+через BinarySearchTree::freeze():
+  - ключи разложены в порядке Эйтцингера (дерево поиска в
+    массиве, потомки узла k - узлы 2k и 2k + 1), массив выровнен
+    по кэш-линии, а дерево дополнено до совершенного ключами
+    с наибольшим значением
+  - поиск идёт без ветвлений, все спуски одной длины, узлы на
+    четыре уровня ниже подгружаются заранее
+  - ключи и значения дополнительно лежат по возрастанию ключа,
+    на них опираются позиции и обход диапазонов
+
+Позиция элемента - его номер по возрастанию ключа, позиция
+size() означает "элемента нет".
+**************************************************************/
+class FrozenIndex
+{
+public:
+    //! Пустой индекс
+    FrozenIndex() = default;
+    //! Заморозить текущее содержимое дерева
+    explicit FrozenIndex(const BinarySearchTree &tree);
+
+    FrozenIndex(FrozenIndex &&other) noexcept = default;
+    FrozenIndex &operator=(FrozenIndex &&other) noexcept = default;
+
+    //! Позиция первого элемента с ключем не меньше key
+    size_t lower_bound(const Key &key) const;
+    //! Позиция первого элемента с ключем больше key
+    size_t upper_bound(const Key &key) const;
+    //! Позиция элемента с ключем key или size(), если его нет
+    size_t find(const Key &key) const;
+    /*!***********************************************************
+    Найти count ключей разом: out[i] - значение для keys[i],
+    found[i] - нашёлся ли ключ (при промахе out[i] не меняется).
+    Спуски идут пачками в ногу, уровень за уровнем, поэтому
+    промахи кэша разных ключей перекрываются. На процессорах
+    с AVX2 восемь спусков выполняются одной векторной командой,
+    иначе - переносимым скалярным ядром find_many_scalar.
+    **************************************************************/
+    void find_many(const Key *keys, size_t count, Value *out, bool *found) const;
+    //! Скалярное ядро find_many без векторных команд
+    void find_many_scalar(const Key *keys, size_t count, Value *out, bool *found) const;
+    //! Будет ли find_many использовать AVX2 на этом процессоре
+    static bool simd_available();
+
+    //! Позиции [first, last) элементов с ключами из [lo, hi)
+    std::pair<size_t, size_t> range(const Key &lo, const Key &hi) const;
+
+    //! Вызвать f(key, value) для каждого элемента с ключем из [lo, hi)
+    template <typename F>
+    void for_each(const Key &lo, const Key &hi, F &&f) const;
+
+    //! Ключ элемента на позиции pos
+    const Key &key(size_t pos) const { return _keys[pos]; }
+    //! Значение элемента на позиции pos
+    const Value &value(size_t pos) const { return _values[pos]; }
+    //! Количество элементов
+    size_t size() const { return _keys.size(); }
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(Key *keys) const;
+    };
+
+    template <bool Upper>
+    size_t search(const Key &key) const;
+    size_t finish_search(size_t k) const;
+    void find_many_avx2(const Key *keys, size_t count, Value *out, bool *found) const;
+
+    std::unique_ptr<Key[], AlignedDelete> _eytzinger; //!< ключи в порядке Эйтцингера, с 1
+    size_t _levels = 0;        //!< высота совершенного дерева
+    std::vector<Key> _keys;    //!< ключи по возрастанию
+    std::vector<Value> _values; //!< значения в порядке ключей
+};
+
+template <typename F>
+void FrozenIndex::for_each(const Key &lo, const Key &hi, F &&f) const {
+    auto [first, last] = range(lo, hi);
+    for (size_t pos = first; pos < last; ++pos) {
+        f(_keys[pos], _values[pos]);
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "BST.h"
+#include "TreeFile.h"
+
+/*!***********************************************************
+Дерево только для чтения прямо над файлом, записанным
+BinarySearchTree::save() (формат см. TreeFile.h):
+  - конструктор отображает файл в память и проверяет заголовок,
+    поэтому открытие стоит O(1) независимо от размера файла;
+    полная проверка контрольной суммы - по запросу
+  - поиск - двоичный без ветвлений по отображённому массиву
+    ключей, страницы подгружаются ядром по мере обращения
+  - значения читаются из отображённого массива значений
+
+Как и у FrozenIndex, позиция элемента - его номер по возрастанию
+ключа, позиция size() означает "элемента нет".
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>>
+class BasicMappedTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "mapped keys and values are used in place, without deserialization");
+
+public:
+    //! \param path файл, записанный save()
+    //! \param verify_checksum прочитать весь файл и сверить контрольную сумму
+    explicit BasicMappedTree(const std::string &path, bool verify_checksum = false, const Compare &compare = Compare());
+
+    BasicMappedTree(BasicMappedTree &&other) noexcept = default;
+    BasicMappedTree &operator=(BasicMappedTree &&other) noexcept = default;
+
+    //! Позиция первого элемента с ключем не меньше key
+    size_t lower_bound(const K &key) const { return search<false>(key); }
+    //! Позиция первого элемента с ключем больше key
+    size_t upper_bound(const K &key) const { return search<true>(key); }
+    //! Позиция первого элемента с ключем key или size(), если его нет
+    size_t find(const K &key) const;
+    //! Позиции [first, last) элементов с ключами из [lo, hi)
+    std::pair<size_t, size_t> range(const K &lo, const K &hi) const;
+
+    //! Вызвать f(key, value) для каждого элемента с ключем из [lo, hi)
+    template <typename F>
+    void for_each(const K &lo, const K &hi, F &&f) const;
+
+    //! Ключ элемента на позиции pos
+    const K &key(size_t pos) const { return _keys[pos]; }
+    //! Значение элемента на позиции pos
+    const V &value(size_t pos) const { return _values[pos]; }
+    //! Количество элементов
+    size_t size() const { return _size; }
+    //! Режим ключей дерева, из которого записан файл
+    KeyMode key_mode() const { return _mode; }
+
+private:
+    template <bool Upper>
+    size_t search(const K &key) const;
+
+    tree_file::MappedFile _file;
+    const K *_keys = nullptr;   //!< ключи по возрастанию, внутри _file
+    const V *_values = nullptr; //!< значения в порядке ключей, внутри _file
+    size_t _size = 0;
+    KeyMode _mode = KeyMode::Unique;
+    Compare _compare;
+};
+
+//! Отображённое дерево с ключами Key и значениями Value
+using MappedTree = BasicMappedTree<Key, Value>;
+
+template <typename K, typename V, typename Compare>
+BasicMappedTree<K, V, Compare>::BasicMappedTree(const std::string &path, bool verify_checksum, const Compare &compare)
+    : _file(tree_file::MappedFile::open(path)), _compare(compare) {
+    const tree_file::Header &header = tree_file::check_header(_file, sizeof(K), sizeof(V), verify_checksum);
+    // Смещения кратны 64, а начало отображения - странице, поэтому массивы выровнены
+    _keys = reinterpret_cast<const K *>(_file.data() + header.keys_offset);
+    _values = reinterpret_cast<const V *>(_file.data() + header.values_offset);
+    _size = size_t(header.count);
+    _mode = KeyMode(header.key_mode);
+    _file.advise(MADV_RANDOM);
+}
+
+//! \brief Двоичный поиск без ветвлений: на каждом шаге base сдвигается или нет
+//! условной пересылкой, а обе возможные середины следующего шага подгружаются заранее
+template <typename K, typename V, typename Compare>
+template <bool Upper>
+size_t BasicMappedTree<K, V, Compare>::search(const K &key) const {
+    if (_size == 0) return 0;
+    const K *base = _keys;
+    size_t n = _size;
+    while (n > 1) {
+        size_t half = n / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        bool right = Upper ? !_compare(key, base[half]) : _compare(base[half], key);
+        base = right ? base + half : base;
+        n -= half;
+    }
+    bool right = Upper ? !_compare(key, *base) : _compare(*base, key);
+    return size_t(base - _keys) + right;
+}
+
+template <typename K, typename V, typename Compare>
+size_t BasicMappedTree<K, V, Compare>::find(const K &key) const {
+    size_t pos = lower_bound(key);
+    return pos < _size && !_compare(key, _keys[pos]) ? pos : _size;
+}
+
+template <typename K, typename V, typename Compare>
+std::pair<size_t, size_t> BasicMappedTree<K, V, Compare>::range(const K &lo, const K &hi) const {
+    if (!_compare(lo, hi)) return {_size, _size};
+    return {lower_bound(lo), lower_bound(hi)};
+}
+
+template <typename K, typename V, typename Compare>
+template <typename F>
+void BasicMappedTree<K, V, Compare>::for_each(const K &lo, const K &hi, F &&f) const {
+    auto [first, last] = range(lo, hi);
+    for (size_t pos = first; pos < last; ++pos) {
+        f(_keys[pos], _values[pos]);
+    }
+}
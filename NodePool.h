@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*!***********************************************************
+Пул узлов фиксированного размера (slab-аллокатор):
+  - память берётся у системы крупными блоками (slab'ами),
+    размер следующего блока растёт вдвое до max_slab
+  - освобождённые узлы попадают в список свободных и
+    переиспользуются следующими allocate()
+  - все блоки отдаются системе разом в release() или деструкторе
+
+Пул только выделяет память, конструирование и разрушение
+объектов остаётся на вызывающей стороне. Блоки берутся у
+аллокатора Alloc, приведённого к типу ячейки пула.
+**************************************************************/
+template <typename T, typename Alloc = std::allocator<T>>
+class NodePool
+{
+public:
+    //! \param first_slab количество узлов в первом блоке
+    //! \param max_slab максимальное количество узлов в одном блоке
+    //! \param alloc аллокатор блоков
+    explicit NodePool(size_t first_slab = 64, size_t max_slab = 64 * 1024, const Alloc &alloc = Alloc())
+        : _alloc(alloc),
+          _next_slab(std::max<size_t>(first_slab, 1)),
+          _max_slab(std::max(max_slab, _next_slab)) {}
+
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+
+    NodePool(NodePool &&other) noexcept : _alloc(other._alloc) { swap(other); }
+    NodePool &operator=(NodePool &&other) noexcept {
+        if (this != &other) {
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~NodePool() { release(); }
+
+    //! Получить память под один узел
+    T *allocate() {
+        if (_free) {
+            Slot *slot = _free;
+            _free = slot->next;
+            return reinterpret_cast<T *>(slot);
+        }
+        if (_cursor == _end) grow();
+        return reinterpret_cast<T *>(_cursor++);
+    }
+
+    //! \brief Получить непрерывную память под count узлов отдельным блоком
+    //! \note Блок освобождается вместе с остальными; ненужные узлы из него можно вернуть через deallocate()
+    T *allocate_block(size_t count) {
+        static_assert(sizeof(Slot) == sizeof(T), "nodes of a block are addressed as T[count]");
+        Slot *slab = SlotTraits::allocate(_alloc, count);
+        _slabs.emplace_back(slab, count);
+        _reserved += count;
+        return reinterpret_cast<T *>(slab);
+    }
+
+    //! Вернуть память узла в список свободных
+    void deallocate(T *node) {
+        Slot *slot = reinterpret_cast<Slot *>(node);
+        slot->next = _free;
+        _free = slot;
+    }
+
+    //! Освободить все блоки разом, не разрушая объекты в них
+    void release() {
+        for (const auto &slab : _slabs) {
+            SlotTraits::deallocate(_alloc, slab.first, slab.second);
+        }
+        _slabs.clear();
+        _free = _cursor = _end = nullptr;
+        _reserved = 0;
+    }
+
+    //! \brief Забрать все блоки пула other: его узлы становятся узлами этого пула
+    //! \note Аллокаторы пулов должны быть равны (проверяет вызывающая сторона),
+    //! блоки отдаются аллокатору этого пула
+    void splice(NodePool &&other) {
+        if (this == &other) return;
+        _slabs.insert(_slabs.end(), other._slabs.begin(), other._slabs.end());
+        _reserved += other._reserved;
+        // Нетронутым остаётся больший из двух остатков, меньший уходит в список свободных
+        if (other._end - other._cursor > _end - _cursor) {
+            std::swap(_cursor, other._cursor);
+            std::swap(_end, other._end);
+        }
+        for (Slot *slot = other._cursor; slot != other._end; ++slot) deallocate(reinterpret_cast<T *>(slot));
+        if (other._free) {
+            Slot *tail = other._free;
+            while (tail->next) tail = tail->next;
+            tail->next = _free;
+            _free = other._free;
+        }
+        other._slabs.clear();
+        other._free = other._cursor = other._end = nullptr;
+        other._reserved = 0;
+    }
+
+    void swap(NodePool &other) noexcept {
+        std::swap(_alloc, other._alloc);
+        std::swap(_slabs, other._slabs);
+        std::swap(_free, other._free);
+        std::swap(_cursor, other._cursor);
+        std::swap(_end, other._end);
+        std::swap(_next_slab, other._next_slab);
+        std::swap(_max_slab, other._max_slab);
+        std::swap(_reserved, other._reserved);
+    }
+
+    //! Сколько байт занято блоками пула
+    size_t bytes_reserved() const { return _reserved * sizeof(Slot); }
+
+    //! Аллокатор, которым пул берёт и отдаёт блоки
+    Alloc get_allocator() const { return Alloc(_alloc); }
+
+private:
+    union Slot
+    {
+        Slot *next; //!< следующий свободный узел
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    using SlotAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+    using SlotTraits = std::allocator_traits<SlotAlloc>;
+
+    void grow() {
+        size_t count = _next_slab;
+        Slot *slab = SlotTraits::allocate(_alloc, count);
+        _slabs.emplace_back(slab, count);
+        _cursor = slab;
+        _end = slab + count;
+        _reserved += count;
+        _next_slab = std::min(_next_slab * 2, _max_slab);
+    }
+
+    SlotAlloc _alloc;           //!< аллокатор блоков
+    std::vector<std::pair<Slot *, size_t>> _slabs; //!< все выделенные блоки и их размеры
+    Slot *_free = nullptr;      //!< список свободных узлов
+    Slot *_cursor = nullptr;    //!< следующий нетронутый узел текущего блока
+    Slot *_end = nullptr;       //!< конец текущего блока
+    size_t _next_slab = 64;     //!< размер следующего блока в узлах
+    size_t _max_slab = 64 * 1024;
+    size_t _reserved = 0;       //!< всего узлов во всех блоках
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+#include "EpochDomain.h"
+
+#if defined(__SANITIZE_THREAD__)
+#define BST_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define BST_TSAN 1
+#endif
+#endif
+
+#ifdef BST_TSAN
+extern "C" void AnnotateIgnoreReadsBegin(const char *file, int line);
+extern "C" void AnnotateIgnoreReadsEnd(const char *file, int line);
+#endif
+
+namespace bst_detail {
+
+//! \brief Барьер seqlock между версией и чтением узлов
+//! \note TSan не моделирует atomic_thread_fence, а оптимистичные чтения он и так
+//! пропускает, поэтому под ним остаётся только барьер компилятора
+inline void seqlock_fence(std::memory_order order) {
+#ifdef BST_TSAN
+    std::atomic_signal_fence(order);
+#else
+    std::atomic_thread_fence(order);
+#endif
+}
+
+} // namespace bst_detail
+
+/*!***********************************************************
+Дерево с поиском без блокировок (оптимистичное чтение):
+  - писатели (insert, erase, insert_batch, clear) идут по одному
+    под мьютексом и на время изменения делают версию дерева
+    нечётной: все повороты и перекраски insert_rb / erase_rb
+    происходят внутри этого окна
+  - читатель запоминает чётную версию, спускается по узлам без
+    блокировок, копирует значение и сверяет версию. Если она
+    изменилась, спуск повторяется; после max_retries неудачных
+    попыток читатель берёт мьютекс писателей
+  - во время записи читатель может увидеть узел наполовину
+    изменённым и даже уйти в цикл из-за поворота, поэтому спуск
+    ограничен max_depth шагами, а прочитанное используется только
+    после сверки версии
+
+Память узлов не уходит из-под читателя: удалённый узел
+возвращается в пул дерева и остаётся узлом того же типа, а блоки
+пула отдаются системе только вместе с деревом. clear() подменяет
+дерево целиком, а старое освобождает после EpochDomain::synchronize(),
+когда все читатели, которые могли его видеть, вышли.
+
+Поэтому ключи и значения должны быть тривиально копируемыми: копию
+ключа или значения, прочитанную посреди записи, безопасно сравнить
+и выбросить.
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>>
+class BasicOptimisticTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "optimistic reads copy keys and values that may be torn by a concurrent writer");
+
+    using Tree = BasicBinarySearchTree<K, V, Compare>;
+    using Node = typename Tree::Node;
+
+    //! Итог спуска без блокировки
+    enum class Probe { Found, Missing, Lost };
+
+public:
+    //! Сколько раз читатель повторяет спуск, прежде чем взять мьютекс
+    static constexpr unsigned max_retries = 8;
+    //! Граница длины спуска: высота LLRB-дерева не больше 2 log2(n)
+    static constexpr size_t max_depth = 2 * 64;
+
+    //! \param mode режим ключей дерева
+    explicit BasicOptimisticTree(KeyMode mode = KeyMode::Unique);
+    ~BasicOptimisticTree();
+
+    BasicOptimisticTree(const BasicOptimisticTree &) = delete;
+    BasicOptimisticTree &operator=(const BasicOptimisticTree &) = delete;
+
+    //! Вставить элемент, см. BinarySearchTree::insert
+    void insert(const K &key, const V &value);
+    //! Удалить все элементы с ключем key
+    void erase(const K &key);
+    //! Вставить пачку одной записью, см. BinarySearchTree::insert_batch
+    void insert_batch(std::vector<std::pair<K, V>> batch);
+    //! Удалить все элементы (ждёт выхода читателей старого дерева)
+    void clear();
+
+    //! Значение первого элемента с ключем key или std::nullopt, без блокировки
+    std::optional<V> find(const K &key) const;
+    //! Есть ли элемент с ключем key, без блокировки
+    bool contains(const K &key) const;
+
+    //! Количество элементов на момент последней завершённой записи
+    size_t size() const;
+    //! Сколько поисков не уложились в max_retries и взяли мьютекс
+    uint64_t fallbacks() const;
+
+private:
+    template <typename Fn>
+    void write(Fn &&change);
+    Probe probe(const Tree &tree, const K &key, std::optional<V> &value) const;
+    std::optional<V> find_locked(const K &key) const;
+
+    KeyMode _mode;
+    mutable std::mutex _write_lock;         //!< очередь писателей и запасной путь читателей
+    alignas(64) std::atomic<uint64_t> _version{0}; //!< нечётная - идёт запись
+    std::atomic<Tree *> _tree;              //!< текущее дерево, меняется только в clear()
+    std::atomic<size_t> _size{0};
+    alignas(64) mutable std::atomic<uint64_t> _fallbacks{0};
+};
+
+//! Дерево с оптимистичным поиском, ключи Key и значения Value
+using OptimisticTree = BasicOptimisticTree<Key, Value>;
+
+template <typename K, typename V, typename Compare>
+BasicOptimisticTree<K, V, Compare>::BasicOptimisticTree(KeyMode mode) : _mode(mode), _tree(new Tree(mode)) {}
+
+template <typename K, typename V, typename Compare>
+BasicOptimisticTree<K, V, Compare>::~BasicOptimisticTree() {
+    delete _tree.load(std::memory_order_relaxed);
+}
+
+//! Выполнить изменение дерева писателем: версия нечётна, пока change() работает
+template <typename K, typename V, typename Compare>
+template <typename Fn>
+void BasicOptimisticTree<K, V, Compare>::write(Fn &&change) {
+    std::lock_guard<std::mutex> guard(_write_lock);
+    uint64_t version = _version.load(std::memory_order_relaxed);
+    _version.store(version + 1, std::memory_order_relaxed);
+    bst_detail::seqlock_fence(std::memory_order_release);
+    Tree &tree = *_tree.load(std::memory_order_relaxed);
+    change(tree);
+    _size.store(tree.size(), std::memory_order_relaxed);
+    _version.store(version + 2, std::memory_order_release);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicOptimisticTree<K, V, Compare>::insert(const K &key, const V &value) {
+    write([&](Tree &tree) { tree.insert(key, value); });
+}
+
+template <typename K, typename V, typename Compare>
+void BasicOptimisticTree<K, V, Compare>::erase(const K &key) {
+    write([&](Tree &tree) { tree.erase(key); });
+}
+
+template <typename K, typename V, typename Compare>
+void BasicOptimisticTree<K, V, Compare>::insert_batch(std::vector<std::pair<K, V>> batch) {
+    write([&](Tree &tree) { tree.insert_batch(std::move(batch)); });
+}
+
+template <typename K, typename V, typename Compare>
+void BasicOptimisticTree<K, V, Compare>::clear() {
+    Tree *fresh = new Tree(_mode);
+    Tree *old;
+    {
+        std::lock_guard<std::mutex> guard(_write_lock);
+        uint64_t version = _version.load(std::memory_order_relaxed);
+        _version.store(version + 1, std::memory_order_relaxed);
+        old = _tree.exchange(fresh, std::memory_order_seq_cst);
+        _size.store(0, std::memory_order_relaxed);
+        _version.store(version + 2, std::memory_order_release);
+    }
+    // Старое дерево ещё могут читать спуски, начатые до подмены
+    EpochDomain::global().synchronize();
+    delete old;
+}
+
+//! \brief Спуск без блокировки. Lost - спуск не уложился в max_depth (дерево
+//! менялось на глазах), результат нужно выбросить
+template <typename K, typename V, typename Compare>
+auto BasicOptimisticTree<K, V, Compare>::probe(const Tree &tree, const K &key, std::optional<V> &value) const -> Probe {
+#ifdef BST_TSAN
+    // Гонки чтения с писателем здесь ожидаемы: прочитанное сверяется с версией
+    AnnotateIgnoreReadsBegin(__FILE__, __LINE__);
+#endif
+    Probe result = Probe::Lost;
+    const Node *node = tree._root;
+    const Node *candidate = nullptr;
+    size_t steps = 0;
+    // Каждое поле узла читается один раз в локальную переменную
+    for (; node && steps < max_depth; ++steps) {
+        K node_key = node->keyValuePair.first;
+        if (_mode == KeyMode::Multi) {
+            // Первый из повторов: спуск до листа, как lower_bound
+            if (tree.less(node_key, key)) {
+                node = node->right;
+            } else {
+                candidate = node;
+                node = node->left;
+            }
+        } else if (tree.less(key, node_key)) {
+            node = node->left;
+        } else if (tree.less(node_key, key)) {
+            node = node->right;
+        } else {
+            candidate = node;
+            break;
+        }
+    }
+    if (!node || candidate == node) {
+        result = Probe::Missing;
+        if (candidate) {
+            K candidate_key = candidate->keyValuePair.first;
+            if (tree.equal(candidate_key, key)) {
+                value = candidate->keyValuePair.second;
+                result = Probe::Found;
+            }
+        }
+    }
+#ifdef BST_TSAN
+    AnnotateIgnoreReadsEnd(__FILE__, __LINE__);
+#endif
+    return result;
+}
+
+template <typename K, typename V, typename Compare>
+std::optional<V> BasicOptimisticTree<K, V, Compare>::find_locked(const K &key) const {
+    std::lock_guard<std::mutex> guard(_write_lock);
+    const Tree &tree = *_tree.load(std::memory_order_relaxed);
+    auto it = tree.find(key);
+    if (it == tree.cend()) return std::nullopt;
+    return it->second;
+}
+
+template <typename K, typename V, typename Compare>
+std::optional<V> BasicOptimisticTree<K, V, Compare>::find(const K &key) const {
+    EpochDomain::Guard guard;
+    if (guard) {
+        for (unsigned attempt = 0; attempt < max_retries; ++attempt) {
+            uint64_t before = _version.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::optional<V> value;
+            Probe result = probe(*_tree.load(std::memory_order_seq_cst), key, value);
+            bst_detail::seqlock_fence(std::memory_order_acquire);
+            if (_version.load(std::memory_order_relaxed) != before || result == Probe::Lost) continue;
+            return value;
+        }
+    }
+    _fallbacks.fetch_add(1, std::memory_order_relaxed);
+    return find_locked(key);
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicOptimisticTree<K, V, Compare>::contains(const K &key) const {
+    return find(key).has_value();
+}
+
+template <typename K, typename V, typename Compare>
+size_t BasicOptimisticTree<K, V, Compare>::size() const {
+    return _size.load(std::memory_order_relaxed);
+}
+
+template <typename K, typename V, typename Compare>
+uint64_t BasicOptimisticTree<K, V, Compare>::fallbacks() const {
+    return _fallbacks.load(std::memory_order_relaxed);
+}
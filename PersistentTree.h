@@ -0,0 +1,486 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+
+/*!***********************************************************
+Персистентное (копирование при записи) левостороннее
+красно-чёрное дерево с уникальными ключами:
+  - snapshot() за O(1) возвращает неизменяемую версию дерева:
+    снимок просто держит ссылку на текущий корень
+  - узлы общие для версий и считают ссылки на себя. insert и
+    erase копируют только те узлы своего пути (и их соседей,
+    которых перекрашивают повороты), на которые ссылается ещё
+    кто-то; узел, который видит только текущая версия, меняется
+    на месте, поэтому без снимков запись не копирует ничего
+  - узел освобождает тот, кто отпустил последнюю ссылку: писатель
+    или поток, закрывший последний снимок, поэтому чтение старых
+    версий не блокирует запись
+
+Родительских указателей у узлов нет (один узел может входить в
+несколько версий), итератор снимка идёт по явному стеку пути.
+Запись и snapshot() сериализуются мьютексом дерева, снимки можно
+читать из любых потоков одновременно с записью.
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>>
+class BasicPersistentTree
+{
+    struct Node
+    {
+        Node(const K &key, const V &value) : keyValuePair(key, value) {}
+        //! Копия узла для новой версии: дети становятся общими
+        Node(const Node &other);
+
+        std::pair<K, V> keyValuePair; //!< Пара ключ - значение
+        Node *left = nullptr;         //!< левый потомок
+        Node *right = nullptr;        //!< правый потомок
+        std::atomic<uint32_t> refs{1}; //!< сколько ссылок (родителей, корней версий) на узел
+        Color color = RED;
+    };
+
+public:
+    class Snapshot;
+
+    //! \param compare порядок ключей
+    explicit BasicPersistentTree(const Compare &compare = Compare());
+    ~BasicPersistentTree();
+
+    BasicPersistentTree(const BasicPersistentTree &) = delete;
+    BasicPersistentTree &operator=(const BasicPersistentTree &) = delete;
+
+    //! Вставить элемент, значение существующего ключа заменяется
+    void insert(const K &key, const V &value);
+    //! Удалить элемент с ключем key
+    void erase(const K &key);
+    //! Удалить все элементы (снимки сохраняют свои версии)
+    void clear();
+
+    //! Неизменяемая текущая версия дерева за O(1)
+    Snapshot snapshot() const;
+    //! Есть ли элемент с ключем key в текущей версии
+    bool contains(const K &key) const;
+    //! Получить размер дерева
+    size_t size() const;
+
+private:
+    static void retain(Node *node);
+    static void release(Node *node);
+    static bool isRed(const Node *node);
+    static const Node *find_node(const Node *root, const K &key, const Compare &compare);
+
+    Node *own(Node *h);
+    Node *rotate_left(Node *h);
+    Node *rotate_right(Node *h);
+    void flip_colors(Node *h);
+    Node *move_red_left(Node *h);
+    Node *move_red_right(Node *h);
+    Node *balance(Node *h);
+    Node *insert_node(Node *h, const K &key, const V &value);
+    Node *erase_node(Node *h, const K &key);
+    Node *erase_min(Node *h);
+
+    mutable std::mutex _lock; //!< сериализует запись и snapshot()
+    Node *_root = nullptr;    //!< корень текущей версии
+    size_t _size = 0;
+    Compare _compare;
+};
+
+//! Персистентное дерево с ключами Key и значениями Value
+using PersistentTree = BasicPersistentTree<Key, Value>;
+
+/*!***********************************************************
+Неизменяемая версия персистентного дерева. Копирование снимка -
+O(1), снимок держит свою версию целиком, пока жив. Чтение снимка
+не берёт блокировок и не мешает записи в дерево.
+**************************************************************/
+template <typename K, typename V, typename Compare>
+class BasicPersistentTree<K, V, Compare>::Snapshot
+{
+public:
+    //! \brief Итератор снимка по возрастанию ключа
+    //! \note Хранит путь от корня: узлы версии не знают родителей
+    class ConstIterator
+    {
+    public:
+        const std::pair<K, V> &operator*() const;
+        const std::pair<K, V> *operator->() const;
+
+        ConstIterator &operator++();
+
+        bool operator==(const ConstIterator &other) const;
+        bool operator!=(const ConstIterator &other) const;
+
+    private:
+        friend class Snapshot;
+        ConstIterator() = default;
+        void push_left(const Node *node);
+
+        std::vector<const Node *> _path; //!< текущий узел сверху, ниже - предки, к которым ещё вернёмся
+    };
+
+    Snapshot() = default;
+    Snapshot(const Snapshot &other);
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot &operator=(Snapshot other) noexcept;
+    ~Snapshot();
+
+    //! Найти элемент с ключем key
+    ConstIterator find(const K &key) const;
+    //! Есть ли элемент с ключем key
+    bool contains(const K &key) const;
+    //! Количество элементов версии
+    size_t size() const;
+
+    ConstIterator begin() const;
+    ConstIterator end() const;
+
+private:
+    friend class BasicPersistentTree;
+    Snapshot(Node *root, size_t size, const Compare &compare);
+
+    Node *_root = nullptr; //!< корень версии, снимок держит на него ссылку
+    size_t _size = 0;
+    Compare _compare;
+};
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::Node::Node(const Node &other)
+    : keyValuePair(other.keyValuePair), left(other.left), right(other.right), color(other.color) {
+    retain(left);
+    retain(right);
+}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::BasicPersistentTree(const Compare &compare) : _compare(compare) {}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::~BasicPersistentTree() {
+    release(_root);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::retain(Node *node) {
+    if (node) node->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+//! Отпустить ссылку на узел; последняя ссылка освобождает узел и отпускает его детей
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::release(Node *node) {
+    while (node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // Рекурсия только влево, правая ветвь - в цикле: глубина не больше высоты дерева
+        release(node->left);
+        Node *right = node->right;
+        delete node;
+        node = right;
+    }
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicPersistentTree<K, V, Compare>::isRed(const Node *node) {
+    return node && node->color == RED;
+}
+
+/*!***********************************************************
+Получить узел h в единоличное владение текущей версии. Ссылка
+на h, через которую пришёл вызывающий, передаётся результату:
+  - если других ссылок на h нет, его можно менять на месте
+  - иначе h копируется, ссылка на старый узел отпускается, а
+    его дети становятся общими для копии и старых версий
+**************************************************************/
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::own(Node *h) -> Node * {
+    // acquire: видеть всё, что сделали с узлом потоки, отпустившие свои ссылки
+    if (h->refs.load(std::memory_order_acquire) == 1) return h;
+    Node *copy = new Node(*h);
+    release(h);
+    return copy;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::rotate_left(Node *h) -> Node * {
+    Node *x = h->right = own(h->right);
+    h->right = x->left;
+    x->left = h;
+    x->color = h->color;
+    h->color = RED;
+    return x;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::rotate_right(Node *h) -> Node * {
+    Node *x = h->left = own(h->left);
+    h->left = x->right;
+    x->right = h;
+    x->color = h->color;
+    h->color = RED;
+    return x;
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::flip_colors(Node *h) {
+    h->left = own(h->left);
+    h->right = own(h->right);
+    h->color = h->color == RED ? BLACK : RED;
+    h->left->color = h->left->color == RED ? BLACK : RED;
+    h->right->color = h->right->color == RED ? BLACK : RED;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::move_red_left(Node *h) -> Node * {
+    flip_colors(h);
+    if (isRed(h->right->left)) {
+        h->right = rotate_right(h->right);
+        h = rotate_left(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::move_red_right(Node *h) -> Node * {
+    flip_colors(h);
+    if (isRed(h->left->left)) {
+        h = rotate_right(h);
+        flip_colors(h);
+    }
+    return h;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::balance(Node *h) -> Node * {
+    if (isRed(h->right) && !isRed(h->left)) h = rotate_left(h);
+    if (isRed(h->left) && isRed(h->left->left)) h = rotate_right(h);
+    if (isRed(h->left) && isRed(h->right)) flip_colors(h);
+    return h;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::insert_node(Node *h, const K &key, const V &value) -> Node * {
+    if (!h) {
+        ++_size;
+        return new Node(key, value);
+    }
+    h = own(h);
+    if (_compare(key, h->keyValuePair.first)) {
+        h->left = insert_node(h->left, key, value);
+    } else if (_compare(h->keyValuePair.first, key)) {
+        h->right = insert_node(h->right, key, value);
+    } else {
+        h->keyValuePair.second = value;
+    }
+    return balance(h);
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::erase_min(Node *h) -> Node * {
+    if (!h->left) {
+        // В LLRB у узла без левого потомка нет и правого
+        release(h);
+        return nullptr;
+    }
+    h = own(h);
+    if (!isRed(h->left) && !isRed(h->left->left)) h = move_red_left(h);
+    h->left = erase_min(h->left);
+    return balance(h);
+}
+
+//! Удаление по Седжвику; ключ key обязан быть в поддереве h
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::erase_node(Node *h, const K &key) -> Node * {
+    h = own(h);
+    if (_compare(key, h->keyValuePair.first)) {
+        if (!isRed(h->left) && !isRed(h->left->left)) h = move_red_left(h);
+        h->left = erase_node(h->left, key);
+    } else {
+        if (isRed(h->left)) h = rotate_right(h);
+        if (!h->right && !_compare(h->keyValuePair.first, key)) {
+            release(h);
+            return nullptr;
+        }
+        if (!isRed(h->right) && !isRed(h->right->left)) h = move_red_right(h);
+        if (!_compare(h->keyValuePair.first, key)) {
+            const Node *successor = h->right;
+            while (successor->left) successor = successor->left;
+            h->keyValuePair = successor->keyValuePair;
+            h->right = erase_min(h->right);
+        } else {
+            h->right = erase_node(h->right, key);
+        }
+    }
+    return balance(h);
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::insert(const K &key, const V &value) {
+    std::lock_guard<std::mutex> guard(_lock);
+    _root = insert_node(_root, key, value);
+    _root->color = BLACK;
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::erase(const K &key) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!find_node(_root, key, _compare)) return;
+    _root = own(_root);
+    if (!isRed(_root->left) && !isRed(_root->right)) _root->color = RED;
+    _root = erase_node(_root, key);
+    if (_root) _root->color = BLACK;
+    --_size;
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::clear() {
+    Node *old;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        old = _root;
+        _root = nullptr;
+        _size = 0;
+    }
+    release(old);
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::snapshot() const -> Snapshot {
+    std::lock_guard<std::mutex> guard(_lock);
+    return Snapshot(_root, _size, _compare);
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicPersistentTree<K, V, Compare>::contains(const K &key) const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return find_node(_root, key, _compare) != nullptr;
+}
+
+template <typename K, typename V, typename Compare>
+size_t BasicPersistentTree<K, V, Compare>::size() const {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _size;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::find_node(const Node *root, const K &key, const Compare &compare) -> const Node * {
+    while (root) {
+        if (compare(key, root->keyValuePair.first)) {
+            root = root->left;
+        } else if (compare(root->keyValuePair.first, key)) {
+            root = root->right;
+        } else {
+            return root;
+        }
+    }
+    return nullptr;
+}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::Snapshot::Snapshot(Node *root, size_t size, const Compare &compare)
+    : _root(root), _size(size), _compare(compare) {
+    retain(_root);
+}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::Snapshot::Snapshot(const Snapshot &other)
+    : _root(other._root), _size(other._size), _compare(other._compare) {
+    retain(_root);
+}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : _root(other._root), _size(other._size), _compare(other._compare) {
+    other._root = nullptr;
+    other._size = 0;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::Snapshot::operator=(Snapshot other) noexcept -> Snapshot & {
+    std::swap(_root, other._root);
+    std::swap(_size, other._size);
+    std::swap(_compare, other._compare);
+    return *this;
+}
+
+template <typename K, typename V, typename Compare>
+BasicPersistentTree<K, V, Compare>::Snapshot::~Snapshot() {
+    release(_root);
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::Snapshot::find(const K &key) const -> ConstIterator {
+    // Путь хранит только предков, от которых спуск ушёл влево: к ним итератор вернётся
+    ConstIterator it;
+    const Node *node = _root;
+    while (node) {
+        if (_compare(key, node->keyValuePair.first)) {
+            it._path.push_back(node);
+            node = node->left;
+        } else if (_compare(node->keyValuePair.first, key)) {
+            node = node->right;
+        } else {
+            it._path.push_back(node);
+            return it;
+        }
+    }
+    return end();
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicPersistentTree<K, V, Compare>::Snapshot::contains(const K &key) const {
+    return find_node(_root, key, _compare) != nullptr;
+}
+
+template <typename K, typename V, typename Compare>
+size_t BasicPersistentTree<K, V, Compare>::Snapshot::size() const {
+    return _size;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::Snapshot::begin() const -> ConstIterator {
+    ConstIterator it;
+    it.push_left(_root);
+    return it;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::Snapshot::end() const -> ConstIterator {
+    return ConstIterator();
+}
+
+template <typename K, typename V, typename Compare>
+void BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::push_left(const Node *node) {
+    for (; node; node = node->left) _path.push_back(node);
+}
+
+template <typename K, typename V, typename Compare>
+const std::pair<K, V> &BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::operator*() const {
+    return _path.back()->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare>
+const std::pair<K, V> *BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::operator->() const {
+    return &_path.back()->keyValuePair;
+}
+
+template <typename K, typename V, typename Compare>
+auto BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::operator++() -> ConstIterator & {
+    const Node *node = _path.back();
+    _path.pop_back();
+    push_left(node->right);
+    return *this;
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::operator==(const ConstIterator &other) const {
+    if (_path.empty() || other._path.empty()) return _path.empty() && other._path.empty();
+    return _path.back() == other._path.back();
+}
+
+template <typename K, typename V, typename Compare>
+bool BasicPersistentTree<K, V, Compare>::Snapshot::ConstIterator::operator!=(const ConstIterator &other) const {
+    return !(*this == other);
+}
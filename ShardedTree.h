@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "BST.h"
+
+/*!***********************************************************
+Дерево для многопоточного доступа, разбитое на шарды:
+  - ключ попадает в шард по хешу, поэтому запись и чтение разных
+    ключей в основном идут в разные шарды
+  - у каждого шарда своя блокировка читатель - писатель: поиски
+    в одном шарде идут параллельно, запись блокирует только свой
+    шард
+  - шарды выровнены по кэш-линии, чтобы блокировки соседних
+    шардов не делили одну линию
+
+Читатели получают копию значения (std::optional), а не итератор:
+после снятия блокировки узел может быть удалён писателем. Обход
+по возрастанию ключа идёт через ordered(), который на время обхода
+держит блокировки чтения всех шардов.
+**************************************************************/
+template <typename K = Key, typename V = Value, typename Compare = std::less<K>,
+          typename Hash = std::hash<K>>
+class BasicShardedTree
+{
+    using Tree = BasicBinarySearchTree<K, V, Compare>;
+
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex lock; //!< блокировка шарда
+        Tree tree;                       //!< элементы шарда
+
+        explicit Shard(KeyMode mode) : tree(mode) {}
+    };
+
+public:
+    class OrderedView;
+
+    //! \param shards количество шардов
+    //! \param mode режим ключей всех шардов
+    explicit BasicShardedTree(size_t shards = 16, KeyMode mode = KeyMode::Unique);
+
+    BasicShardedTree(const BasicShardedTree &) = delete;
+    BasicShardedTree &operator=(const BasicShardedTree &) = delete;
+
+    //! Вставить элемент, см. BinarySearchTree::insert
+    void insert(const K &key, const V &value);
+    //! Удалить все элементы с ключем key
+    void erase(const K &key);
+    //! Вставить пачку: элементы раскладываются по шардам, каждый шард блокируется один раз
+    void insert_batch(const std::vector<std::pair<K, V>> &batch);
+    //! Значение первого элемента с ключем key или std::nullopt
+    std::optional<V> find(const K &key) const;
+    //! Есть ли элемент с ключем key
+    bool contains(const K &key) const;
+    //! Удалить все элементы
+    void clear();
+
+    //! Количество элементов (шарды опрашиваются по очереди, поэтому при
+    //! одновременной записи это значение на какой-то момент обхода)
+    size_t size() const;
+    //! Количество шардов
+    size_t shard_count() const;
+    //! Номер шарда, в котором лежит ключ key
+    size_t shard_of(const K &key) const;
+
+    //! Обход всех элементов по возрастанию ключа, запись на время обхода блокируется
+    OrderedView ordered() const;
+
+private:
+    std::vector<std::unique_ptr<Shard>> _shards; //!< шарды, каждый в своей кэш-линии
+    Hash _hash;                                  //!< хеш ключей
+    Compare _compare;                            //!< порядок ключей для слияния шардов
+};
+
+//! Шардированное дерево с ключами Key и значениями Value
+using ShardedTree = BasicShardedTree<Key, Value>;
+
+/*!***********************************************************
+Упорядоченный обход шардированного дерева. Пока вид существует,
+он держит блокировки чтения всех шардов (берутся по возрастанию
+номера шарда, как и любая другая пара блокировок), поэтому
+итераторы шардов остаются действительными. Итератор сливает
+шарды через кучу из текущих элементов каждого шарда: шаг стоит
+O(log N) для N шардов.
+**************************************************************/
+template <typename K, typename V, typename Compare, typename Hash>
+class BasicShardedTree<K, V, Compare, Hash>::OrderedView
+{
+    using TreeIterator = typename Tree::ConstIterator;
+
+public:
+    //! Итератор слияния шардов
+    class ConstIterator
+    {
+    public:
+        const std::pair<K, V> &operator*() const;
+        const std::pair<K, V> *operator->() const;
+
+        ConstIterator &operator++();
+
+        bool operator==(const ConstIterator &other) const;
+        bool operator!=(const ConstIterator &other) const;
+
+    private:
+        friend class OrderedView;
+        ConstIterator() = default;
+        explicit ConstIterator(const OrderedView *view);
+        bool heap_less(size_t a, size_t b) const;
+
+        const OrderedView *_view = nullptr;
+        std::vector<TreeIterator> _cursors; //!< текущий элемент каждого шарда
+        std::vector<size_t> _heap;          //!< непустые шарды, сверху - с наименьшим ключом
+    };
+
+    explicit OrderedView(const BasicShardedTree &tree);
+
+    ConstIterator begin() const;
+    ConstIterator end() const;
+
+private:
+    const BasicShardedTree *_tree;
+    std::vector<std::shared_lock<std::shared_mutex>> _locks;
+};
+
+template <typename K, typename V, typename Compare, typename Hash>
+BasicShardedTree<K, V, Compare, Hash>::BasicShardedTree(size_t shards, KeyMode mode) {
+    _shards.reserve(std::max<size_t>(shards, 1));
+    for (size_t i = 0; i < std::max<size_t>(shards, 1); ++i) {
+        _shards.push_back(std::make_unique<Shard>(mode));
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+size_t BasicShardedTree<K, V, Compare, Hash>::shard_of(const K &key) const {
+    // Хеш перемешивается умножением: у std::hash целых чисел он совпадает с ключом
+    uint64_t mixed = uint64_t(_hash(key)) * 0x9E3779B97F4A7C15ull;
+    return size_t((mixed >> 32) * _shards.size() >> 32);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+size_t BasicShardedTree<K, V, Compare, Hash>::shard_count() const {
+    return _shards.size();
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+void BasicShardedTree<K, V, Compare, Hash>::insert(const K &key, const V &value) {
+    Shard &shard = *_shards[shard_of(key)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.tree.insert(key, value);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+void BasicShardedTree<K, V, Compare, Hash>::erase(const K &key) {
+    Shard &shard = *_shards[shard_of(key)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.tree.erase(key);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+void BasicShardedTree<K, V, Compare, Hash>::insert_batch(const std::vector<std::pair<K, V>> &batch) {
+    std::vector<std::vector<std::pair<K, V>>> parts(_shards.size());
+    for (const auto &pair : batch) parts[shard_of(pair.first)].push_back(pair);
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (parts[i].empty()) continue;
+        std::unique_lock<std::shared_mutex> guard(_shards[i]->lock);
+        _shards[i]->tree.insert_batch(std::move(parts[i]));
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+std::optional<V> BasicShardedTree<K, V, Compare, Hash>::find(const K &key) const {
+    const Shard &shard = *_shards[shard_of(key)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    auto it = shard.tree.find(key);
+    if (it == shard.tree.cend()) return std::nullopt;
+    return it->second;
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+bool BasicShardedTree<K, V, Compare, Hash>::contains(const K &key) const {
+    const Shard &shard = *_shards[shard_of(key)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree.find(key) != shard.tree.cend();
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+void BasicShardedTree<K, V, Compare, Hash>::clear() {
+    for (auto &shard : _shards) {
+        std::unique_lock<std::shared_mutex> guard(shard->lock);
+        shard->tree.clear();
+    }
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+size_t BasicShardedTree<K, V, Compare, Hash>::size() const {
+    size_t total = 0;
+    for (const auto &shard : _shards) {
+        std::shared_lock<std::shared_mutex> guard(shard->lock);
+        total += shard->tree.size();
+    }
+    return total;
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+auto BasicShardedTree<K, V, Compare, Hash>::ordered() const -> OrderedView {
+    return OrderedView(*this);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+BasicShardedTree<K, V, Compare, Hash>::OrderedView::OrderedView(const BasicShardedTree &tree) : _tree(&tree) {
+    _locks.reserve(tree._shards.size());
+    for (const auto &shard : tree._shards) _locks.emplace_back(shard->lock);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+auto BasicShardedTree<K, V, Compare, Hash>::OrderedView::begin() const -> ConstIterator {
+    return ConstIterator(this);
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+auto BasicShardedTree<K, V, Compare, Hash>::OrderedView::end() const -> ConstIterator {
+    return ConstIterator();
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::ConstIterator(const OrderedView *view) : _view(view) {
+    const auto &shards = view->_tree->_shards;
+    _cursors.reserve(shards.size());
+    for (size_t i = 0; i < shards.size(); ++i) {
+        _cursors.push_back(shards[i]->tree.cbegin());
+        if (_cursors[i] != shards[i]->tree.cend()) _heap.push_back(i);
+    }
+    std::make_heap(_heap.begin(), _heap.end(), [this](size_t a, size_t b) { return heap_less(a, b); });
+}
+
+//! Порядок кучи: сверху шард с наименьшим текущим ключом, при равных ключах - с меньшим номером
+template <typename K, typename V, typename Compare, typename Hash>
+bool BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::heap_less(size_t a, size_t b) const {
+    const Compare &compare = _view->_tree->_compare;
+    const K &key_a = _cursors[a]->first;
+    const K &key_b = _cursors[b]->first;
+    if (compare(key_b, key_a)) return true;
+    if (compare(key_a, key_b)) return false;
+    return a > b;
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+const std::pair<K, V> &BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::operator*() const {
+    return *_cursors[_heap.front()];
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+const std::pair<K, V> *BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::operator->() const {
+    return &*_cursors[_heap.front()];
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+auto BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::operator++() -> ConstIterator & {
+    auto order = [this](size_t a, size_t b) { return heap_less(a, b); };
+    std::pop_heap(_heap.begin(), _heap.end(), order);
+    size_t shard = _heap.back();
+    if (++_cursors[shard] == _view->_tree->_shards[shard]->tree.cend()) {
+        _heap.pop_back();
+    } else {
+        std::push_heap(_heap.begin(), _heap.end(), order);
+    }
+    return *this;
+}
+
+//! Итераторы равны, если оба дошли до конца или стоят на одном элементе
+template <typename K, typename V, typename Compare, typename Hash>
+bool BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::operator==(const ConstIterator &other) const {
+    if (_heap.empty() || other._heap.empty()) return _heap.empty() && other._heap.empty();
+    return &**this == &*other;
+}
+
+template <typename K, typename V, typename Compare, typename Hash>
+bool BasicShardedTree<K, V, Compare, Hash>::OrderedView::ConstIterator::operator!=(const ConstIterator &other) const {
+    return !(*this == other);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!***********************************************************
+Пул потоков для параллельного "разделяй и властвуй":
+  - fork_join(left, right) отдаёт left в очередь пула, сам
+    выполняет right и ждёт left
+  - пока left не готов, ожидающий поток сам выполняет задачи из
+    очереди (в том числе, скорее всего, свою же left), поэтому
+    вложенные fork_join не блокируют пул
+  - без рабочих потоков (одно ядро) обе части выполняются по
+    очереди в вызывающем потоке
+Задачи не должны бросать исключений.
+**************************************************************/
+class ThreadPool
+{
+public:
+    //! \param workers количество рабочих потоков (вызывающий поток работает тоже)
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    //! Общий пул процесса: рабочих потоков на один меньше, чем ядер
+    static ThreadPool &shared();
+
+    //! Сколько потоков выполняют задачи, включая вызывающий
+    size_t concurrency() const;
+
+    //! Выполнить left и right, возможно параллельно, и дождаться обеих
+    template <typename Left, typename Right>
+    void fork_join(Left &&left, Right &&right);
+
+private:
+    struct Task
+    {
+        std::function<void()> run;
+        std::atomic<bool> done{false};
+    };
+
+    void work();
+    bool run_one();
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::deque<Task *> _queue; //!< рабочие берут задачи с начала, ожидающие - с конца
+    std::vector<std::thread> _workers;
+    bool _stop = false;
+};
+
+inline ThreadPool::ThreadPool(size_t workers) {
+    _workers.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) _workers.emplace_back([this] { work(); });
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &worker : _workers) worker.join();
+}
+
+inline ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+inline size_t ThreadPool::concurrency() const {
+    return _workers.size() + 1;
+}
+
+inline void ThreadPool::work() {
+    std::unique_lock<std::mutex> guard(_lock);
+    while (true) {
+        _wake.wait(guard, [this] { return _stop || !_queue.empty(); });
+        if (_queue.empty()) return;
+        Task *task = _queue.front();
+        _queue.pop_front();
+        guard.unlock();
+        task->run();
+        task->done.store(true, std::memory_order_release);
+        guard.lock();
+    }
+}
+
+//! Выполнить одну задачу из очереди в текущем потоке; false - очередь пуста
+inline bool ThreadPool::run_one() {
+    Task *task;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_queue.empty()) return false;
+        // С конца: самая свежая и самая мелкая задача, чаще всего своя же
+        task = _queue.back();
+        _queue.pop_back();
+    }
+    task->run();
+    task->done.store(true, std::memory_order_release);
+    return true;
+}
+
+template <typename Left, typename Right>
+void ThreadPool::fork_join(Left &&left, Right &&right) {
+    if (_workers.empty()) {
+        left();
+        right();
+        return;
+    }
+    Task task;
+    task.run = std::ref(left);
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _queue.push_back(&task);
+    }
+    _wake.notify_one();
+    right();
+    while (!task.done.load(std::memory_order_acquire)) {
+        if (!run_one()) std::this_thread::yield();
+    }
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*!***********************************************************
+Двоичный формат снимка дерева на диске (POSIX, порядок байт
+машины, которая его записала):
+  - заголовок Header в начале файла
+  - ключи по возрастанию, массив K[count] с границы 64 байт
+  - значения в том же порядке, массив V[count] с границы 64 байт
+Массивы лежат как в памяти, поэтому файл можно отобразить через
+mmap и искать прямо в нём (см. MappedTree.h). Контрольная сумма
+покрывает всё после заголовка.
+**************************************************************/
+namespace tree_file {
+
+constexpr char MAGIC[8] = {'B', 'S', 'T', 'F', 'I', 'L', 'E', '\0'};
+constexpr uint32_t VERSION = 1;
+//! Записывается как есть: при чтении на машине с другим порядком байт не совпадёт
+constexpr uint32_t ENDIAN_MARK = 0x01020304;
+constexpr size_t ALIGNMENT = 64;
+
+struct Header
+{
+    char magic[8];          //!< MAGIC
+    uint32_t version;       //!< VERSION
+    uint32_t byte_order;    //!< ENDIAN_MARK
+    uint32_t key_size;      //!< sizeof(K)
+    uint32_t value_size;    //!< sizeof(V)
+    uint32_t key_mode;      //!< KeyMode дерева
+    uint32_t reserved;
+    uint64_t count;         //!< количество элементов
+    uint64_t keys_offset;   //!< смещение массива ключей
+    uint64_t values_offset; //!< смещение массива значений
+    uint64_t file_size;     //!< полный размер файла
+    uint64_t checksum;      //!< checksum() байтов [sizeof(Header), file_size)
+};
+
+//! Округлить смещение вверх до границы ALIGNMENT
+inline uint64_t align_up(uint64_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+//! Заголовок с раскладкой файла для count элементов
+inline Header make_header(size_t key_size, size_t value_size, uint32_t key_mode, uint64_t count) {
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = ENDIAN_MARK;
+    header.key_size = uint32_t(key_size);
+    header.value_size = uint32_t(value_size);
+    header.key_mode = key_mode;
+    header.count = count;
+    header.keys_offset = align_up(sizeof(Header));
+    header.values_offset = align_up(header.keys_offset + count * key_size);
+    header.file_size = header.values_offset + count * value_size;
+    return header;
+}
+
+/*!***********************************************************
+64-битная контрольная сумма в духе xxHash64: четыре независимые
+полосы по 8 байт, поэтому умножения не ждут друг друга и сумма
+считается со скоростью чтения памяти.
+**************************************************************/
+inline uint64_t checksum(const void *data, size_t size) {
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t lane, uint64_t word) { return rotl(lane + word * P2, 31) * P1; };
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t lanes[4] = {P1 + P2, P2, 0, 0 - P1};
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+        for (size_t i = 0; i < 4; ++i) {
+            uint64_t word;
+            std::memcpy(&word, bytes + pos + 8 * i, 8);
+            lanes[i] = round(lanes[i], word);
+        }
+    }
+    uint64_t hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18) + size;
+    for (; pos + 8 <= size; pos += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + pos, 8);
+        hash = rotl(hash ^ round(0, word), 27) * P1 + P3;
+    }
+    for (; pos < size; ++pos) hash = rotl(hash ^ (bytes[pos] * P1), 11) * P2;
+    hash ^= hash >> 33;
+    hash *= P2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+/*!***********************************************************
+Файл, отображённый в память (RAII над open / mmap / munmap):
+  - open() отображает существующий файл только для чтения
+  - create() создаёт файл заданного размера для записи
+Ошибки системы бросаются как std::system_error.
+**************************************************************/
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile &&other) noexcept { swap(other); }
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        MappedFile(std::move(other)).swap(*this);
+        return *this;
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {
+        if (_data) ::munmap(_data, _size);
+    }
+
+    //! Отобразить файл path только для чтения
+    static MappedFile open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail("open", path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            fail("fstat", path);
+        }
+        MappedFile file;
+        file._size = size_t(info.st_size);
+        if (file._size > 0) {
+            void *data = ::mmap(nullptr, file._size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                fail("mmap", path);
+            }
+            file._data = data;
+        }
+        ::close(fd);
+        return file;
+    }
+
+    //! Создать (или обрезать) файл path размера size и отобразить его для записи
+    static MappedFile create(const std::string &path, size_t size) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) fail("open", path);
+        if (::ftruncate(fd, off_t(size)) != 0) {
+            ::close(fd);
+            fail("ftruncate", path);
+        }
+        MappedFile file;
+        file._size = size;
+        void *data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            fail("mmap", path);
+        }
+        file._data = data;
+        ::close(fd);
+        return file;
+    }
+
+    //! Подсказать ядру порядок доступа к страницам (MADV_SEQUENTIAL, MADV_RANDOM, ...)
+    void advise(int advice) const {
+        if (_data) ::madvise(_data, _size, advice);
+    }
+
+    //! Сбросить изменённые страницы на диск
+    void sync() const {
+        if (_data && ::msync(_data, _size, MS_SYNC) != 0) fail("msync", "");
+    }
+
+    const unsigned char *data() const { return static_cast<const unsigned char *>(_data); }
+    unsigned char *data() { return static_cast<unsigned char *>(_data); }
+    size_t size() const { return _size; }
+
+    void swap(MappedFile &other) noexcept {
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+    }
+
+    [[noreturn]] static void fail(const char *call, const std::string &path) {
+        throw std::system_error(errno, std::generic_category(), std::string("MappedFile: ") + call + " " + path);
+    }
+
+private:
+    void *_data = nullptr;
+    size_t _size = 0;
+};
+
+//! \brief Проверить заголовок отображённого файла и вернуть его
+//! \note Ошибки формата бросаются как std::runtime_error
+inline const Header &check_header(const MappedFile &file, size_t key_size, size_t value_size, bool verify_checksum) {
+    if (file.size() < sizeof(Header)) throw std::runtime_error("tree_file: файл короче заголовка");
+    const Header &header = *reinterpret_cast<const Header *>(file.data());
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) throw std::runtime_error("tree_file: это не файл дерева");
+    if (header.byte_order != ENDIAN_MARK) throw std::runtime_error("tree_file: другой порядок байт");
+    if (header.version != VERSION) throw std::runtime_error("tree_file: неизвестная версия формата");
+    if (header.key_size != key_size || header.value_size != value_size) {
+        throw std::runtime_error("tree_file: размеры ключа или значения не совпадают");
+    }
+    if (header.key_mode > 1) throw std::runtime_error("tree_file: неизвестный режим ключей");
+    // Без этой проверки count * key_size может переполниться и совпасть с размером файла
+    if (header.count > file.size() / (key_size + value_size)) {
+        throw std::runtime_error("tree_file: размер файла не совпадает с заголовком");
+    }
+    Header expected = make_header(key_size, value_size, header.key_mode, header.count);
+    if (header.keys_offset != expected.keys_offset || header.values_offset != expected.values_offset ||
+        header.file_size != expected.file_size || header.file_size != file.size()) {
+        throw std::runtime_error("tree_file: размер файла не совпадает с заголовком");
+    }
+    if (verify_checksum && checksum(file.data() + sizeof(Header), file.size() - sizeof(Header)) != header.checksum) {
+        throw std::runtime_error("tree_file: контрольная сумма не совпадает");
+    }
+    return header;
+}
+
+} // namespace tree_file
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*!***********************************************************
+Снимок счётчиков и формы дерева, см. BasicBinarySearchTree::stats()
+(только при сборке с BST_STATS):
+  - спуски поиска во внутренних find_node, lower_bound_node и
+    upper_bound_node, через которые идут только поиски: find,
+    equalRange, lower_bound, upper_bound, min(key) / max(key) и
+    RangeView::empty. Спуски вставки и удаления, включая
+    проверку ключа в erase, и обход range() не считаются; с
+    BST_FIND_CACHE find в режиме Unique считается только при
+    промахе кэша,
+    сравнения ключей в них и гистограмма глубины спуска -
+    сколько узлов прошёл каждый спуск
+  - повороты и перекраски во вставке, удалении и слиянии
+  - узлы, выделенные из пула и возвращённые в него по одному
+  - чёрная высота и граница высоты, которая из неё следует:
+    красные узлы не идут подряд, поэтому любой путь не длиннее
+    двух чёрных высот
+Форма считается за O(log n) по левому краю дерева, без полного
+обхода, как в max_height().
+**************************************************************/
+struct TreeStats
+{
+    //! Корзин в гистограмме глубины; в последнюю попадают и более глубокие спуски
+    static constexpr size_t depth_buckets = 64;
+
+    uint64_t searches = 0;     //!< спусков поиска
+    uint64_t comparisons = 0;  //!< сравнений ключей в спусках поиска
+    std::array<uint64_t, depth_buckets> search_depths{}; //!< спусков, прошедших d узлов
+    uint64_t inserts = 0;      //!< вставок, включая замену значения
+    uint64_t erases = 0;       //!< удалений одного узла
+    uint64_t rotations = 0;    //!< поворотов влево и вправо
+    uint64_t color_flips = 0;  //!< перекрасок узла с двумя потомками
+    uint64_t allocations = 0;  //!< узлов, выделенных из пула
+    uint64_t deallocations = 0; //!< узлов, возвращённых в пул по одному (clear() отдаёт пул целиком)
+    size_t size = 0;           //!< элементов в дереве
+    size_t black_height = 0;   //!< чёрных узлов на любом пути от корня до листа
+    size_t height_bound = 0;   //!< 2 * black_height: высота дерева не больше
+    size_t bytes_reserved = 0; //!< байт в блоках пула узлов
+
+    //! Среднее число сравнений на один спуск поиска
+    double comparisons_per_search() const { return searches ? double(comparisons) / double(searches) : 0; }
+};
+
+//! \brief Снимок строками "имя значение", по строке на счётчик и на непустую корзину гистограммы
+//! \note Формат читается сборщиками метрик, которые понимают текстовый формат Prometheus
+inline std::ostream &operator<<(std::ostream &out, const TreeStats &stats) {
+    out << "bst_searches " << stats.searches << '\n'
+        << "bst_comparisons " << stats.comparisons << '\n';
+    for (size_t depth = 0; depth < stats.search_depths.size(); ++depth) {
+        if (stats.search_depths[depth]) {
+            out << "bst_search_depth{depth=\"" << depth << "\"} " << stats.search_depths[depth] << '\n';
+        }
+    }
+    out << "bst_inserts " << stats.inserts << '\n'
+        << "bst_erases " << stats.erases << '\n'
+        << "bst_rotations " << stats.rotations << '\n'
+        << "bst_color_flips " << stats.color_flips << '\n'
+        << "bst_allocations " << stats.allocations << '\n'
+        << "bst_deallocations " << stats.deallocations << '\n'
+        << "bst_size " << stats.size << '\n'
+        << "bst_black_height " << stats.black_height << '\n'
+        << "bst_height_bound " << stats.height_bound << '\n'
+        << "bst_bytes_reserved " << stats.bytes_reserved << '\n';
+    return out;
+}
+
+namespace bst_detail {
+
+/*!***********************************************************
+Счётчики дерева за снимком TreeStats. Константный поиск может
+идти из нескольких потоков, а слияния деревьев поворачивают
+узлы параллельно, поэтому счётчики атомарные; порядок памяти
+relaxed, снимок не согласован между счётчиками.
+**************************************************************/
+struct StatCounters
+{
+    std::atomic<uint64_t> searches{0};
+    std::atomic<uint64_t> comparisons{0};
+    std::array<std::atomic<uint64_t>, TreeStats::depth_buckets> search_depths{};
+    std::atomic<uint64_t> inserts{0};
+    std::atomic<uint64_t> erases{0};
+    std::atomic<uint64_t> rotations{0};
+    std::atomic<uint64_t> color_flips{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> deallocations{0};
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    //! Спуск поиска, прошедший depth узлов и сделавший comparisons сравнений
+    void search(size_t depth, size_t comparisons_made) {
+        add(searches);
+        add(comparisons, comparisons_made);
+        add(search_depths[depth < TreeStats::depth_buckets ? depth : TreeStats::depth_buckets - 1]);
+    }
+
+    //! Перенести значения в снимок
+    void copy_to(TreeStats &stats) const {
+        auto load = [](const std::atomic<uint64_t> &counter) { return counter.load(std::memory_order_relaxed); };
+        stats.searches = load(searches);
+        stats.comparisons = load(comparisons);
+        for (size_t i = 0; i < TreeStats::depth_buckets; ++i) stats.search_depths[i] = load(search_depths[i]);
+        stats.inserts = load(inserts);
+        stats.erases = load(erases);
+        stats.rotations = load(rotations);
+        stats.color_flips = load(color_flips);
+        stats.allocations = load(allocations);
+        stats.deallocations = load(deallocations);
+    }
+
+    void reset() {
+        for (auto *counter : {&searches, &comparisons, &inserts, &erases, &rotations, &color_flips,
+                              &allocations, &deallocations}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        for (auto &counter : search_depths) counter.store(0, std::memory_order_relaxed);
+    }
+};
+
+} // namespace bst_detail
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TreeFile.h"
+
+/*!***********************************************************
+Журнал упреждающей записи (POSIX, порядок байт машины):
+  - заголовок Header в начале файла
+  - дальше записи фиксированного размера подряд:
+    операция (1 байт), ключ, значение, контрольная сумма (4 байта)
+Записи только дописываются в конец. Оборванная при сбое запись
+в хвосте не проходит проверку суммы, и чтение на ней
+останавливается.
+**************************************************************/
+namespace wal {
+
+constexpr char MAGIC[8] = {'B', 'S', 'T', 'W', 'A', 'L', '\0', '\0'};
+constexpr uint32_t VERSION = 1;
+
+struct Header
+{
+    char magic[8];        //!< MAGIC
+    uint32_t version;     //!< VERSION
+    uint32_t endian_mark; //!< tree_file::ENDIAN_MARK
+    uint32_t key_size;    //!< sizeof(K)
+    uint32_t value_size;  //!< sizeof(V)
+    uint32_t key_mode;    //!< KeyMode дерева
+    uint32_t reserved;
+};
+
+//! Операция в записи журнала; 0 не используется, чтобы нули в хвосте не читались как запись
+enum class Op : uint8_t { Insert = 1, Erase = 2 };
+
+//! Размер записи журнала в байтах
+constexpr size_t record_size(size_t key_size, size_t value_size) {
+    return 1 + key_size + value_size + sizeof(uint32_t);
+}
+
+inline Header make_header(size_t key_size, size_t value_size, uint32_t key_mode) {
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.endian_mark = tree_file::ENDIAN_MARK;
+    header.key_size = uint32_t(key_size);
+    header.value_size = uint32_t(value_size);
+    header.key_mode = key_mode;
+    return header;
+}
+
+//! Контрольная сумма записи без её последних четырёх байт
+inline uint32_t record_checksum(const unsigned char *record, size_t size) {
+    return uint32_t(tree_file::checksum(record, size - sizeof(uint32_t)));
+}
+
+/*!***********************************************************
+Файл журнала, открытый на дописывание (RAII над open / close).
+Ошибки системы бросаются как std::system_error.
+**************************************************************/
+class LogFile
+{
+public:
+    LogFile() = default;
+    LogFile(LogFile &&other) noexcept { swap(other); }
+    LogFile &operator=(LogFile &&other) noexcept {
+        LogFile(std::move(other)).swap(*this);
+        return *this;
+    }
+    LogFile(const LogFile &) = delete;
+    LogFile &operator=(const LogFile &) = delete;
+    ~LogFile() {
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    //! Открыть существующий файл path на дописывание
+    static LogFile open(const std::string &path) {
+        LogFile file;
+        file._fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+        if (file._fd < 0) fail("open", path);
+        file._path = path;
+        return file;
+    }
+
+    //! \brief Создать пустой журнал path с заголовком header
+    //! \note Заголовок пишется в path + ".tmp", сбрасывается на диск, и только потом файл
+    //! переименовывается в path: журнал под именем path всегда с целым заголовком
+    static LogFile create(const std::string &path, const Header &header) {
+        std::string temporary = path + ".tmp";
+        LogFile file;
+        file._fd = ::open(temporary.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644);
+        if (file._fd < 0) fail("open", temporary);
+        file._path = temporary;
+        file.append(&header, sizeof(header));
+        file.sync();
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) fail("rename", path);
+        file._path = path;
+        return file;
+    }
+
+    //! Дописать size байт в конец файла
+    void append(const void *data, size_t size) {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t written = ::write(_fd, bytes, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                fail("write", _path);
+            }
+            bytes += written;
+            size -= size_t(written);
+        }
+    }
+
+    //! Дождаться, пока дописанное окажется на диске
+    void sync() {
+        if (::fdatasync(_fd) != 0) fail("fdatasync", _path);
+    }
+
+    //! Обрезать файл до size байт (отбросить оборванный хвост)
+    void truncate(uint64_t size) {
+        if (::ftruncate(_fd, off_t(size)) != 0) fail("ftruncate", _path);
+    }
+
+    void swap(LogFile &other) noexcept {
+        std::swap(_fd, other._fd);
+        std::swap(_path, other._path);
+    }
+
+    [[noreturn]] static void fail(const char *call, const std::string &path) {
+        throw std::system_error(errno, std::generic_category(), std::string("LogFile: ") + call + " " + path);
+    }
+
+private:
+    int _fd = -1;
+    std::string _path;
+};
+
+//! \brief Проверить заголовок отображённого журнала и вернуть его
+//! \note Ошибки формата бросаются как std::runtime_error
+inline const Header &check_header(const tree_file::MappedFile &file, size_t key_size, size_t value_size) {
+    if (file.size() < sizeof(Header)) throw std::runtime_error("wal: файл короче заголовка");
+    const Header &header = *reinterpret_cast<const Header *>(file.data());
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) throw std::runtime_error("wal: это не журнал дерева");
+    if (header.endian_mark != tree_file::ENDIAN_MARK) throw std::runtime_error("wal: другой порядок байт");
+    if (header.version != VERSION) throw std::runtime_error("wal: неизвестная версия формата");
+    if (header.key_size != key_size || header.value_size != value_size) {
+        throw std::runtime_error("wal: размеры ключа или значения не совпадают");
+    }
+    return header;
+}
+
+//! Сбросить на диск каталог path: без этого созданный или переименованный файл может пропасть после сбоя
+inline void sync_directory(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) LogFile::fail("open", path);
+    if (::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        LogFile::fail("fsync", path);
+    }
+    ::close(fd);
+}
+
+} // namespace wal
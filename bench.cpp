@@ -0,0 +1,984 @@
+// Замеры производительности дерева
+// Сборка: cmake -S . -B build && cmake --build build --target bench
+// (или g++ -O2 -std=c++17 -pthread CompactTree.cpp FrozenIndex.cpp bench.cpp -o bench)
+// Запуск: ./bench [имя_замера] [количество_элементов]
+// С -DBST_ORDER_STATISTICS добавляется замер order_stats, с -DBST_RANGE_AGGREGATES - range_aggregate;
+// с -DBST_STATS - stats; iterate стоит запускать в сборках с -DBST_THREADED и без,
+// find_cache - с -DBST_FIND_CACHE и без
+#include "BST.h"
+#include "CompactTree.h"
+#include "DurableTree.h"
+#include "FrozenIndex.h"
+#include "MappedTree.h"
+#include "OptimisticTree.h"
+#include "PersistentTree.h"
+#include "ThreadPool.h"
+#include "ShardedTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+//! Время выполнения f в миллисекундах
+template <typename F>
+double measure_ms(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(finish - start).count();
+}
+
+//! Случайные ключи без повторов
+std::vector<Key> random_keys(size_t n, uint32_t seed = 42) {
+    std::vector<Key> keys(n);
+    std::iota(keys.begin(), keys.end(), Key(0));
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(seed));
+    return keys;
+}
+
+//! Узел того же размера, что и узел дерева
+struct PlainNode
+{
+    std::pair<Key, Value> keyValuePair;
+    PlainNode *parent, *left, *right;
+    Color color;
+};
+
+//! Пул узлов против new/delete на каждый узел: выделить n узлов,
+//! освободить их в случайном порядке, выделить заново и освободить всё
+void bench_node_pool(size_t n) {
+    std::vector<PlainNode *> nodes(n);
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::shuffle(order.begin(), order.end(), std::mt19937(7));
+
+    double heap_ms = measure_ms([&] {
+        for (auto &node : nodes) node = new PlainNode{};
+        for (size_t i : order) delete nodes[i];
+        for (auto &node : nodes) node = new PlainNode{};
+        for (auto node : nodes) delete node;
+    });
+
+    double pool_ms = measure_ms([&] {
+        NodePool<PlainNode> pool;
+        for (auto &node : nodes) node = new (pool.allocate()) PlainNode{};
+        for (size_t i : order) pool.deallocate(nodes[i]);
+        for (auto &node : nodes) node = new (pool.allocate()) PlainNode{};
+    });
+
+    std::cout << "node_pool: " << n << " узлов, new/delete " << heap_ms
+              << " мс, пул " << pool_ms << " мс\n";
+}
+
+//! Вставка n случайных ключей и разрушение дерева
+void bench_tree_insert(size_t n) {
+    auto keys = random_keys(n);
+    double insert_ms = 0;
+    double destroy_ms = 0;
+    {
+        auto *tree = new BinarySearchTree;
+        insert_ms = measure_ms([&] {
+            for (Key key : keys) tree->insert(key, key * 0.5);
+        });
+        destroy_ms = measure_ms([&] { delete tree; });
+    }
+    std::cout << "tree_insert: " << n << " ключей, вставка " << insert_ms
+              << " мс, разрушение " << destroy_ms << " мс\n";
+}
+
+//! Загрузка отсортированных пар: build_from_sorted против вставки по одной
+void bench_bulk_load(size_t n) {
+    std::vector<std::pair<Key, Value>> pairs(n);
+    for (size_t i = 0; i < n; ++i) pairs[i] = {Key(i), i * 0.5};
+
+    BinarySearchTree inserted;
+    double insert_ms = measure_ms([&] {
+        for (const auto &pair : pairs) inserted.insert(pair.first, pair.second);
+    });
+
+    BinarySearchTree built;
+    double build_ms = measure_ms([&] { built.build_from_sorted(pairs.begin(), pairs.end()); });
+
+    std::cout << "bulk_load: " << n << " пар, insert " << insert_ms
+              << " мс, build_from_sorted " << build_ms << " мс\n";
+}
+
+//! Средняя задержка одной операции в наносекундах
+void bench_op_latency(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    double insert_ms = measure_ms([&] {
+        for (Key key : keys) tree.insert(key, key * 0.5);
+    });
+    size_t height = 0;
+    double height_ms = measure_ms([&] { height = tree.max_height(); });
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+    double erase_ms = measure_ms([&] {
+        for (Key key : keys) tree.erase(key);
+    });
+    std::cout << "op_latency: " << n << " ключей, insert " << insert_ms * 1e6 / n
+              << " нс/оп, erase " << erase_ms * 1e6 / n << " нс/оп, max_height "
+              << height_ms << " мс (высота " << height << ")\n";
+}
+
+//! Пачки вставок и удалений: insert/erase в цикле против insert_batch/erase_batch
+void bench_batch(size_t n) {
+    std::vector<std::pair<Key, Value>> base(n);
+    for (size_t i = 0; i < n; ++i) base[i] = {Key(2 * i), 1.0};
+
+    for (size_t batch_size : {n / 1000, n / 100, n / 10, n / 2}) {
+        if (batch_size == 0) continue;
+        std::mt19937 rng(3);
+        std::vector<std::pair<Key, Value>> batch(batch_size);
+        std::vector<Key> keys(batch_size);
+        for (size_t i = 0; i < batch_size; ++i) {
+            Key key = Key(2 * (rng() % n) + 1);
+            batch[i] = {key, 2.0};
+            keys[i] = key;
+        }
+
+        BinarySearchTree looped(base.begin(), base.end());
+        double loop_insert_ms = measure_ms([&] {
+            for (const auto &pair : batch) looped.insert(pair.first, pair.second);
+        });
+        double loop_erase_ms = measure_ms([&] {
+            for (Key key : keys) looped.erase(key);
+        });
+
+        BinarySearchTree batched(base.begin(), base.end());
+        double batch_insert_ms = measure_ms([&] { batched.insert_batch(batch); });
+        double batch_erase_ms = measure_ms([&] { batched.erase_batch(keys); });
+
+        std::cout << "batch: дерево " << n << ", пачка " << batch_size
+                  << ": insert " << loop_insert_ms << " мс, insert_batch " << batch_insert_ms
+                  << " мс; erase " << loop_erase_ms << " мс, erase_batch " << batch_erase_ms << " мс\n";
+    }
+}
+
+//! Поиск и обход: узлы на указателях против компактных узлов на индексах
+template <typename Tree>
+void run_layout(const char *name, const std::vector<Key> &keys, const std::vector<Key> &probes) {
+    Tree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+    double sum = 0;
+    double find_ms = measure_ms([&] {
+        for (Key key : probes) sum += tree.find(key)->second;
+    });
+    double scan_ms = measure_ms([&] {
+        for (auto it = tree.cbegin(); it != tree.cend(); ++it) sum += it->second;
+    });
+    std::cout << "layout: " << name << ", " << keys.size() << " ключей, "
+              << double(tree.bytes_reserved()) / keys.size() << " байт/элемент, find "
+              << find_ms * 1e6 / probes.size() << " нс/оп, обход " << scan_ms << " мс"
+              << (sum < 0 ? "!" : "") << "\n";
+}
+
+void bench_layout(size_t n) {
+    auto keys = random_keys(n);
+    auto probes = random_keys(n, 17);
+    run_layout<BinarySearchTree>("BinarySearchTree", keys, probes);
+    run_layout<CompactTree>("CompactTree", keys, probes);
+}
+
+//! Поиск в живом LLRB-дереве против замороженного индекса
+void bench_freeze(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(2 * key, key * 0.5);
+    std::vector<Key> probes(n);
+    std::mt19937 rng(5);
+    for (Key &probe : probes) probe = Key(rng() % (2 * n));
+
+    FrozenIndex frozen;
+    double freeze_ms = measure_ms([&] { frozen = tree.freeze(); });
+
+    size_t hits = 0;
+    double tree_ms = measure_ms([&] {
+        for (Key key : probes) hits += tree.find(key) != tree.end();
+    });
+    double frozen_ms = measure_ms([&] {
+        for (Key key : probes) hits += frozen.find(key) != frozen.size();
+    });
+    double sum = 0;
+    double scan_ms = measure_ms([&] {
+        frozen.for_each(0, Key(n), [&](Key, Value value) { sum += value; });
+    });
+
+    std::cout << "freeze: " << n << " ключей, freeze " << freeze_ms << " мс, find дерево "
+              << tree_ms * 1e6 / n << " нс/оп, find индекс " << frozen_ms * 1e6 / n
+              << " нс/оп, диапазон на " << n / 2 << " ключей " << scan_ms << " мс"
+              << (hits + sum < 0 ? "!" : "") << "\n";
+}
+
+//! Пропускная способность поиска: по одному ключу против find_many
+void bench_find_many(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(2 * key, key * 0.5);
+    FrozenIndex frozen = tree.freeze();
+
+    std::vector<Key> probes(n);
+    std::mt19937 rng(5);
+    for (Key &probe : probes) probe = Key(rng() % (2 * n));
+    std::vector<Value> out(n);
+    std::unique_ptr<bool[]> found(new bool[n]);
+
+    auto report = [&](const char *name, double ms) {
+        std::cout << "find_many: " << n << " ключей, " << name << " "
+                  << n / ms * 1e-3 << " млн поисков/с\n";
+    };
+    report("дерево find", measure_ms([&] {
+        for (size_t i = 0; i < n; ++i) {
+            auto it = tree.find(probes[i]);
+            found[i] = it != tree.end();
+            if (found[i]) out[i] = it->second;
+        }
+    }));
+    report("дерево find_many", measure_ms([&] {
+        tree.find_many(probes.data(), n, out.data(), found.get());
+    }));
+    report("индекс find", measure_ms([&] {
+        for (size_t i = 0; i < n; ++i) {
+            size_t pos = frozen.find(probes[i]);
+            found[i] = pos != frozen.size();
+            if (found[i]) out[i] = frozen.value(pos);
+        }
+    }));
+    report("индекс find_many_scalar", measure_ms([&] {
+        frozen.find_many_scalar(probes.data(), n, out.data(), found.get());
+    }));
+    report(FrozenIndex::simd_available() ? "индекс find_many (AVX2)" : "индекс find_many (без AVX2)",
+           measure_ms([&] { frozen.find_many(probes.data(), n, out.data(), found.get()); }));
+}
+
+//! Горячие ключи с тысячами повторов: equalRange, min(key) и max(key) в режиме Multi
+void bench_multimap(size_t n) {
+    const size_t duplicates = 4096;
+    size_t hot_keys = std::max<size_t>(1, n / duplicates);
+    std::vector<std::pair<Key, Value>> pairs(hot_keys * duplicates);
+    std::mt19937 rng(9);
+    for (size_t i = 0; i < pairs.size(); ++i) pairs[i] = {Key(i % hot_keys), double(rng() % 1000000)};
+
+    BinarySearchTree tree(KeyMode::Multi);
+    double insert_ms = measure_ms([&] {
+        for (const auto &pair : pairs) tree.insert(pair.first, pair.second);
+    });
+
+    const size_t probes = 100000;
+    double sum = 0;
+    double range_ms = measure_ms([&] {
+        for (size_t i = 0; i < probes; ++i) {
+            auto range = tree.equalRange(Key(i % hot_keys));
+            sum += range.first->second;
+        }
+    });
+    double minmax_ms = measure_ms([&] {
+        for (size_t i = 0; i < probes; ++i) {
+            Key key = Key(i % hot_keys);
+            sum += tree.min(key)->second + tree.max(key)->second;
+        }
+    });
+    double erase_ms = measure_ms([&] {
+        for (size_t key = 0; key < hot_keys; ++key) tree.erase(Key(key));
+    });
+
+    std::cout << "multimap: " << hot_keys << " ключей по " << duplicates << " повторов, insert "
+              << insert_ms * 1e6 / pairs.size() << " нс/оп, equalRange " << range_ms * 1e6 / probes
+              << " нс/оп, min+max " << minmax_ms * 1e6 / probes << " нс/оп, erase всех повторов "
+              << erase_ms << " мс" << (sum < 0 ? "!" : "") << "\n";
+}
+
+//! Порядок ключей, который шаблон не распознаёт: равенство проверяется двумя сравнениями
+struct OpaqueLess
+{
+    bool operator()(Key a, Key b) const { return a < b; }
+};
+
+//! Вставка, поиск и удаление n случайных ключей в дереве типа Tree
+template <typename Tree>
+void run_template(const char *name, const std::vector<Key> &keys, const std::vector<Key> &probes) {
+    Tree tree;
+    double insert_ms = measure_ms([&] {
+        for (Key key : keys) tree.insert(key, key * 0.5);
+    });
+    double sum = 0;
+    double find_ms = measure_ms([&] {
+        for (Key key : probes) sum += tree.find(key)->second;
+    });
+    double erase_ms = measure_ms([&] {
+        for (Key key : probes) tree.erase(key);
+    });
+    size_t n = keys.size();
+    std::cout << "template: " << name << ", " << n << " ключей, insert " << insert_ms * 1e6 / n
+              << " нс/оп, find " << find_ms * 1e6 / n << " нс/оп, erase " << erase_ms * 1e6 / n
+              << " нс/оп" << (sum < 0 ? "!" : "") << "\n";
+}
+
+//! Шаблонное дерево: быстрые ветви для целых ключей против общего пути через Compare
+void bench_template(size_t n) {
+    auto keys = random_keys(n);
+    auto probes = random_keys(n, 17);
+    run_template<BinarySearchTree>("BinarySearchTree", keys, probes);
+    run_template<BasicBinarySearchTree<Key, Value, OpaqueLess>>("Compare без быстрых ветвей", keys, probes);
+}
+
+//! Пропускная способность threads потоков в млн оп/с, каждый выполняет ops операций op(rng);
+//! op возвращает число, которое складывается, чтобы поиски не выбрасывались компилятором
+template <typename Op>
+double run_threads(size_t threads, size_t ops, Op op) {
+    std::vector<std::thread> workers;
+    std::vector<double> sums(threads);
+    double ms = measure_ms([&] {
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&op, &sums, ops, t] {
+                std::mt19937 rng(uint32_t(t + 1));
+                double sum = 0;
+                for (size_t i = 0; i < ops; ++i) sum += op(rng);
+                sums[t] = sum;
+            });
+        }
+        for (auto &worker : workers) worker.join();
+    });
+    if (std::accumulate(sums.begin(), sums.end(), 0.0) < 0) std::cout << "!";
+    return threads * ops / ms * 1e-3;
+}
+
+//! Смешанная нагрузка из нескольких потоков: дерево за общим мьютексом против ShardedTree
+void bench_sharded(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree locked;
+    std::mutex lock;
+    ShardedTree sharded(16);
+    for (Key key : keys) {
+        locked.insert(key, key * 0.5);
+        sharded.insert(key, key * 0.5);
+    }
+    const size_t ops = 200000;
+    size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned reads : {100u, 90u, 50u}) {
+        for (size_t threads : {size_t(1), size_t(2), size_t(4), size_t(8)}) {
+            double mutex_mops = run_threads(threads, ops, [&](std::mt19937 &rng) {
+                Key key = Key(rng() % n);
+                bool read = rng() % 100 < reads;
+                std::lock_guard<std::mutex> guard(lock);
+                if (read) return locked.find(key)->second;
+                locked.insert(key, 1.0);
+                return 0.0;
+            });
+            double sharded_mops = run_threads(threads, ops, [&](std::mt19937 &rng) {
+                Key key = Key(rng() % n);
+                if (rng() % 100 < reads) return *sharded.find(key);
+                sharded.insert(key, 1.0);
+                return 0.0;
+            });
+            std::cout << "sharded: " << n << " ключей, чтений " << reads << "%, потоков " << threads
+                      << " (ядер " << hardware << "): мьютекс " << mutex_mops
+                      << " млн оп/с, ShardedTree " << sharded_mops << " млн оп/с\n";
+        }
+    }
+}
+
+//! Смешанная нагрузка: ShardedTree (блокировки чтения) против OptimisticTree (поиск без блокировок)
+void bench_optimistic(size_t n) {
+    auto keys = random_keys(n);
+    ShardedTree sharded(16);
+    OptimisticTree optimistic;
+    for (Key key : keys) {
+        sharded.insert(key, key * 0.5);
+        optimistic.insert(key, key * 0.5);
+    }
+    const size_t ops = 200000;
+    size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned reads : {100u, 99u, 90u}) {
+        for (size_t threads : {size_t(1), size_t(2), size_t(4), size_t(8)}) {
+            double sharded_mops = run_threads(threads, ops, [&](std::mt19937 &rng) {
+                Key key = Key(rng() % n);
+                if (rng() % 100 < reads) return *sharded.find(key);
+                sharded.insert(key, 1.0);
+                return 0.0;
+            });
+            uint64_t fallbacks = optimistic.fallbacks();
+            double optimistic_mops = run_threads(threads, ops, [&](std::mt19937 &rng) {
+                Key key = Key(rng() % n);
+                if (rng() % 100 < reads) return *optimistic.find(key);
+                optimistic.insert(key, 1.0);
+                return 0.0;
+            });
+            std::cout << "optimistic: " << n << " ключей, чтений " << reads << "%, потоков " << threads
+                      << " (ядер " << hardware << "): ShardedTree " << sharded_mops
+                      << " млн оп/с, OptimisticTree " << optimistic_mops << " млн оп/с, поисков под мьютексом "
+                      << optimistic.fallbacks() - fallbacks << "\n";
+        }
+    }
+}
+
+//! Персистентное дерево: вставки без снимков и со снимком каждые 1000 записей,
+//! снимок за O(1) против копии дерева сборкой из отсортированных пар
+void bench_persistent(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree plain;
+    double plain_ms = measure_ms([&] {
+        for (Key key : keys) plain.insert(key, key * 0.5);
+    });
+    PersistentTree quiet;
+    double quiet_ms = measure_ms([&] {
+        for (Key key : keys) quiet.insert(key, key * 0.5);
+    });
+    PersistentTree snapshotted;
+    PersistentTree::Snapshot last;
+    double snapshotted_ms = measure_ms([&] {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            snapshotted.insert(keys[i], keys[i] * 0.5);
+            if (i % 1000 == 0) last = snapshotted.snapshot();
+        }
+    });
+
+    size_t last_size = last.size();
+    last = PersistentTree::Snapshot();
+    const size_t rounds = 1000;
+    double snapshot_ms = measure_ms([&] {
+        for (size_t i = 0; i < rounds; ++i) last = quiet.snapshot();
+    });
+    BinarySearchTree copy;
+    double copy_ms = measure_ms([&] {
+        copy.build_from_sorted(plain.cbegin(), plain.cend());
+    });
+    std::cout << "persistent: " << n << " вставок, BinarySearchTree " << plain_ms
+              << " мс, PersistentTree " << quiet_ms << " мс, со снимком каждые 1000 записей "
+              << snapshotted_ms << " мс; snapshot() " << snapshot_ms * 1e6 / rounds
+              << " нс, копия дерева " << copy_ms << " мс\n";
+    if (last_size + last.size() + copy.size() == 0) std::cout << "!";
+}
+
+//! Операции над двумя деревьями по n элементов (половина ключей общая) против вставок по одному в случайном порядке
+void bench_set_ops(size_t n) {
+    std::vector<std::pair<Key, Value>> base, delta;
+    for (size_t i = 0; i < n; ++i) {
+        base.emplace_back(Key(2 * i), 1.0);
+        delta.emplace_back(Key(2 * i + i % 2), 2.0);
+    }
+    std::vector<std::pair<Key, Value>> shuffled = delta;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(5));
+    auto make = [](const std::vector<std::pair<Key, Value>> &pairs) {
+        return BinarySearchTree(pairs.begin(), pairs.end());
+    };
+
+    BinarySearchTree inserted = make(base);
+    double insert_ms = measure_ms([&] {
+        for (const auto &pair : shuffled) inserted.insert(pair.first, pair.second);
+    });
+    BinarySearchTree united = make(base);
+    BinarySearchTree other = make(delta);
+    double unite_ms = measure_ms([&] { united.unite(std::move(other)); });
+    BinarySearchTree intersected = make(base);
+    other = make(delta);
+    double intersect_ms = measure_ms([&] { intersected.intersect(std::move(other)); });
+    BinarySearchTree reduced = make(base);
+    other = make(delta);
+    double difference_ms = measure_ms([&] { reduced.difference(std::move(other)); });
+    BinarySearchTree whole = make(base);
+    BinarySearchTree upper;
+    double split_ms = measure_ms([&] { upper = whole.split(Key(n)); });
+    double join_ms = measure_ms([&] { whole.join(std::move(upper)); });
+
+    std::cout << "set_ops: 2 x " << n << " элементов, потоков " << ThreadPool::shared().concurrency()
+              << ": insert по одному " << insert_ms << " мс, unite " << unite_ms
+              << " мс (" << united.size() << "), intersect " << intersect_ms
+              << " мс (" << intersected.size() << "), difference " << difference_ms
+              << " мс (" << reduced.size() << "), split пополам " << split_ms
+              << " мс, join " << join_ms << " мс\n";
+    if (inserted.size() != united.size()) std::cout << "!";
+}
+
+//! Снимок на диске: save, load в дерево и открытие MappedTree против вставки заново;
+//! поиск в отображённом файле против поиска в дереве
+void bench_persist(size_t n) {
+    auto keys = random_keys(n);
+    std::string path = (std::filesystem::temp_directory_path() / "bst_bench.bst").string();
+    BinarySearchTree tree;
+    double insert_ms = measure_ms([&] {
+        for (Key key : keys) tree.insert(2 * key, key * 0.5);
+    });
+    double save_ms = measure_ms([&] { tree.save(path); });
+    BinarySearchTree loaded;
+    double load_ms = measure_ms([&] { loaded.load(path); });
+    double open_ms = measure_ms([&] { MappedTree probe(path); });
+    double verify_ms = measure_ms([&] { MappedTree probe(path, true); });
+    MappedTree mapped(path);
+
+    std::vector<Key> probes(n);
+    std::mt19937 rng(5);
+    for (Key &probe : probes) probe = Key(rng() % (2 * n));
+    size_t hits = 0;
+    double tree_ms = measure_ms([&] {
+        for (Key key : probes) hits += loaded.find(key) != loaded.end();
+    });
+    double mapped_ms = measure_ms([&] {
+        for (Key key : probes) hits += mapped.find(key) != mapped.size();
+    });
+    double bytes = double(std::filesystem::file_size(path)) / n;
+    std::filesystem::remove(path);
+
+    std::cout << "persist: " << n << " ключей, вставка " << insert_ms << " мс, save " << save_ms
+              << " мс, load " << load_ms << " мс, открыть MappedTree " << open_ms
+              << " мс (с контрольной суммой " << verify_ms << " мс), файл " << bytes
+              << " байт/ключ, find дерево " << tree_ms * 1e6 / n << " нс/оп, find MappedTree "
+              << mapped_ms * 1e6 / n << " нс/оп" << (hits == 0 ? "!" : "") << "\n";
+}
+
+//! Цена журнала на пути записи: вставки без журнала против DurableTree при разных
+//! sync_every, групповая фиксация из четырёх потоков, проигрывание журнала и контрольная точка
+void bench_wal(size_t n) {
+    // fdatasync на каждую запись - миллисекунды на диске, поэтому операций не больше 100000
+    size_t ops = std::min<size_t>(n, 100000);
+    auto keys = random_keys(ops);
+    std::string dir = (std::filesystem::temp_directory_path() / "bst_bench_wal").string();
+
+    BinarySearchTree plain;
+    double plain_ms = measure_ms([&] {
+        for (Key key : keys) plain.insert(key, key * 0.5);
+    });
+    std::cout << "wal: " << ops << " вставок, без журнала " << ops / plain_ms / 1e3 << " млн оп/с\n";
+
+    WalOptions options;
+    options.checkpoint_bytes = 0;
+    for (size_t sync_every : {1, 8, 64, 512, 4096}) {
+        std::filesystem::remove_all(dir);
+        options.sync_every = sync_every;
+        BasicDurableTree<Key, Value> tree(dir, KeyMode::Unique, options);
+        double ms = measure_ms([&] {
+            for (Key key : keys) tree.insert(key, key * 0.5);
+            tree.flush();
+        });
+        std::cout << "wal: sync_every " << sync_every << ": " << ops / ms / 1e3 << " млн оп/с, "
+                  << ms * 1e6 / ops << " нс/оп, fdatasync " << tree.commits() << "\n";
+    }
+
+    const size_t threads = 4;
+    std::filesystem::remove_all(dir);
+    options.sync_every = 1;
+    double replay_ms = 0, checkpoint_ms = 0;
+    uint64_t commits = 0;
+    {
+        DurableTree tree(dir, KeyMode::Unique, options);
+        double group_ms = measure_ms([&] {
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t] {
+                    for (size_t i = t; i < ops; i += threads) tree.insert(keys[i], keys[i] * 0.5);
+                });
+            }
+            for (auto &worker : workers) worker.join();
+        });
+        commits = tree.commits();
+        std::cout << "wal: sync_every 1, " << threads << " потока: " << ops / group_ms / 1e3
+                  << " млн оп/с, fdatasync " << commits << " (" << double(ops) / commits << " записей на fdatasync)\n";
+    }
+    {
+        std::unique_ptr<DurableTree> tree;
+        replay_ms = measure_ms([&] { tree = std::make_unique<DurableTree>(dir); });
+        checkpoint_ms = measure_ms([&] { tree->checkpoint(); });
+    }
+    std::cout << "wal: проигрывание " << ops << " записей " << replay_ms << " мс, контрольная точка "
+              << checkpoint_ms << " мс\n";
+    std::filesystem::remove_all(dir);
+}
+
+//! Текстовая выгрузка и загрузка через файл: построчный вывод с std::endl и чтение
+//! operator>> против export_text / import_text (по порядку и вперемешку), в МБ/с
+void bench_text(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.37);
+    std::string path = (std::filesystem::temp_directory_path() / "bst_bench.csv").string();
+    auto megabytes = [&] { return double(std::filesystem::file_size(path)) / (1 << 20); };
+
+    double endl_ms = measure_ms([&] {
+        std::ofstream out(path);
+        for (auto it = tree.cbegin(); it != tree.cend(); ++it) out << it->first << ',' << it->second << std::endl;
+    });
+    double endl_mb = megabytes();
+    double stream_ms = measure_ms([&] {
+        std::ifstream in(path);
+        BinarySearchTree loaded;
+        Key key;
+        Value value;
+        char comma;
+        while (in >> key >> comma >> value) loaded.insert(key, value);
+    });
+
+    double export_ms = measure_ms([&] {
+        std::ofstream out(path, std::ios::binary);
+        tree.export_text(out);
+    });
+    double mb = megabytes();
+    BinarySearchTree loaded;
+    double import_ms = measure_ms([&] {
+        std::ifstream in(path, std::ios::binary);
+        loaded.import_text(in);
+    });
+
+    // Те же строки вперемешку: загрузка пачками insert_batch
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(in, line);) lines.push_back(std::move(line));
+        std::shuffle(lines.begin(), lines.end(), std::mt19937(3));
+        std::ofstream out(path, std::ios::binary);
+        for (const auto &line : lines) out << line << '\n';
+    }
+    BinarySearchTree shuffled;
+    double shuffled_ms = measure_ms([&] {
+        std::ifstream in(path, std::ios::binary);
+        shuffled.import_text(in);
+    });
+    std::filesystem::remove(path);
+
+    std::cout << "text: " << n << " строк, std::endl " << endl_mb / endl_ms * 1e3 << " МБ/с, operator>> + insert "
+              << endl_mb / stream_ms * 1e3 << " МБ/с, export_text " << mb / export_ms * 1e3
+              << " МБ/с, import_text по порядку " << mb / import_ms * 1e3 << " МБ/с, вперемешку "
+              << mb / shuffled_ms * 1e3 << " МБ/с" << (loaded.size() + shuffled.size() != 2 * n ? "!" : "") << "\n";
+}
+
+//! Просмотр диапазонов: lower_bound и Iterator с подъёмом по parent против range()
+//! со стеком и предвыборкой, на дереве после случайных вставок и на собранном из сортированных пар
+void bench_range_scan(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree inserted;
+    for (Key key : keys) inserted.insert(key, key * 0.5);
+    std::vector<std::pair<Key, Value>> pairs;
+    for (size_t i = 0; i < n; ++i) pairs.emplace_back(Key(i), i * 0.5);
+    BinarySearchTree built(pairs.begin(), pairs.end());
+
+    const size_t queries = 1000;
+    const Key width = Key(std::max<size_t>(n / 100, 1));
+    std::vector<Key> starts(queries);
+    std::mt19937 rng(13);
+    for (Key &start : starts) start = Key(rng() % n);
+
+    for (const BinarySearchTree *tree : {&inserted, &built}) {
+        double sum = 0;
+        size_t visited = 0;
+        double iterator_ms = measure_ms([&] {
+            for (Key lo : starts) {
+                for (auto it = tree->lower_bound(lo); it != tree->cend() && it->first < lo + width; ++it) {
+                    sum += it->second;
+                    ++visited;
+                }
+            }
+        });
+        double range_ms = measure_ms([&] {
+            for (Key lo : starts) {
+                for (const auto &pair : tree->range(lo, lo + width)) sum += pair.second;
+            }
+        });
+        double full_iterator_ms = measure_ms([&] {
+            for (auto it = tree->cbegin(); it != tree->cend(); ++it) sum += it->second;
+        });
+        double full_range_ms = measure_ms([&] {
+            for (const auto &pair : tree->range(0, Key(n))) sum += pair.second;
+        });
+        std::cout << "range_scan: " << n << " ключей, " << (tree == &inserted ? "случайные вставки" : "build_from_sorted")
+                  << ": диапазоны по " << width << " Iterator " << iterator_ms * 1e6 / visited << " нс/элемент, range "
+                  << range_ms * 1e6 / visited << " нс/элемент; всё дерево Iterator " << full_iterator_ms
+                  << " мс, range " << full_range_ms << " мс" << (sum < 0 ? "!" : "") << "\n";
+    }
+}
+
+//! Шаги итератора: обход вперёд и назад, задержка одного ++ (p50, p99.9, максимум),
+//! begin() / max() и цена поддержки связей на вставке и удалении. Сравнивать сборки
+//! с -DBST_THREADED и без
+void bench_iterate(size_t n) {
+#ifdef BST_THREADED
+    const char *mode = "с BST_THREADED";
+#else
+    const char *mode = "без BST_THREADED";
+#endif
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    double insert_ms = measure_ms([&] {
+        for (Key key : keys) tree.insert(key, key * 0.5);
+    });
+
+    double sum = 0;
+    double forward_ms = measure_ms([&] {
+        for (auto it = tree.begin(); it != tree.end(); ++it) sum += it->second;
+    });
+    double backward_ms = measure_ms([&] {
+        for (auto it = tree.max(); it != tree.cend(); --it) sum += it->second;
+    });
+
+    // Каждый шаг отдельно: время часов одинаково для обеих сборок, важны хвосты
+    std::vector<double> steps;
+    steps.reserve(std::min<size_t>(n, 1000000));
+    auto it = tree.cbegin();
+    while (it != tree.cend() && steps.size() < steps.capacity()) {
+        auto start = std::chrono::steady_clock::now();
+        ++it;
+        auto finish = std::chrono::steady_clock::now();
+        steps.push_back(std::chrono::duration<double, std::nano>(finish - start).count());
+    }
+    std::sort(steps.begin(), steps.end());
+
+    const size_t calls = 1000000;
+    double ends_ms = measure_ms([&] {
+        for (size_t i = 0; i < calls; ++i) sum += tree.cbegin()->second + tree.max()->second;
+    });
+    double erase_ms = measure_ms([&] {
+        for (Key key : keys) tree.erase(key);
+    });
+
+    std::cout << "iterate: " << n << " ключей " << mode << ": вставка " << insert_ms << " мс, обход вперёд "
+              << forward_ms << " мс, назад " << backward_ms << " мс, шаг ++ p50 " << steps[steps.size() / 2]
+              << " нс, p99.9 " << steps[steps.size() * 999 / 1000] << " нс, max " << steps.back()
+              << " нс, begin() + max() " << ends_ms * 1e6 / calls << " нс, удаление " << erase_ms << " мс"
+              << (sum < 0 ? "!" : "") << "\n";
+}
+
+//! Копирование дерева: конструктор копирования против вставки всех элементов в пустое дерево
+void bench_clone(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+
+    size_t copied = 0;
+    double insert_ms = measure_ms([&] {
+        BinarySearchTree copy;
+        for (auto it = tree.cbegin(); it != tree.cend(); ++it) copy.insert(it->first, it->second);
+        copied += copy.size();
+    });
+    std::unique_ptr<BinarySearchTree> copy;
+    double clone_ms = measure_ms([&] { copy = std::make_unique<BinarySearchTree>(tree); });
+    copied += copy->size();
+    // Узлы копии лежат в одном блоке почти в порядке обхода, у исходного дерева - вперемешку
+    double sum = 0;
+    double source_scan_ms = measure_ms([&] {
+        for (auto it = tree.cbegin(); it != tree.cend(); ++it) sum += it->second;
+    });
+    double copy_scan_ms = measure_ms([&] {
+        for (auto it = copy->cbegin(); it != copy->cend(); ++it) sum -= it->second;
+    });
+
+    std::cout << "clone: " << n << " ключей, " << ThreadPool::shared().concurrency() << " потоков, вставками "
+              << insert_ms << " мс, копированием " << clone_ms << " мс, обход исходного " << source_scan_ms
+              << " мс, обход копии " << copy_scan_ms << " мс, " << double(copy->bytes_reserved()) / n
+              << " байт/элемент" << (copied != 2 * n || sum != 0 ? "!" : "") << "\n";
+}
+
+//! Поиск по ключам с перекосом Ципфа (theta = 0.99) и равномерным. find идёт через кэш
+//! BST_FIND_CACHE, lower_bound спускается по дереву всегда и служит опорой в той же сборке;
+//! из трёх прогонов берётся лучший
+void bench_find_cache(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+
+    // Ранги по закону Ципфа через накопленные веса, ранг r - ключ keys[r]
+    std::vector<double> weights(n);
+    double total = 0;
+    for (size_t i = 0; i < n; ++i) weights[i] = total += std::pow(double(i + 1), -0.99);
+    const size_t queries = 1000000;
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<double> uniform(0, total);
+    std::vector<Key> skewed(queries);
+    for (Key &key : skewed) {
+        size_t rank = size_t(std::lower_bound(weights.begin(), weights.end(), uniform(rng)) - weights.begin());
+        key = keys[std::min(rank, n - 1)];
+    }
+    std::vector<Key> flat(queries);
+    for (Key &key : flat) key = keys[rng() % n];
+
+    double sum = 0;
+    auto best_ns = [&](const std::vector<Key> &probes, bool descend) {
+        double best = 0;
+        for (int round = 0; round < 3; ++round) {
+            double ms = measure_ms([&] {
+                if (descend) {
+                    for (Key key : probes) sum += tree.lower_bound(key)->second;
+                } else {
+                    for (Key key : probes) sum += tree.find(key)->second;
+                }
+            });
+            best = round == 0 ? ms : std::min(best, ms);
+        }
+        return best * 1e6 / queries;
+    };
+#ifdef BST_FIND_CACHE
+    const char *mode = "с BST_FIND_CACHE";
+    tree.reset_find_cache_stats();
+#else
+    const char *mode = "без BST_FIND_CACHE";
+#endif
+    double skewed_find = best_ns(skewed, false);
+#ifdef BST_FIND_CACHE
+    FindCacheStats stats = tree.find_cache_stats();
+#endif
+    double skewed_descent = best_ns(skewed, true);
+    double flat_find = best_ns(flat, false);
+    double flat_descent = best_ns(flat, true);
+    std::cout << "find_cache: " << n << " ключей " << mode << ": Ципф find " << skewed_find << " нс, спуск "
+              << skewed_descent << " нс; равномерно find " << flat_find << " нс, спуск " << flat_descent << " нс";
+#ifdef BST_FIND_CACHE
+    std::cout << "; попаданий по Ципфу " << stats.hit_rate() * 100 << "%";
+#endif
+    std::cout << (sum < 0 ? "!" : "") << "\n";
+}
+
+#ifdef BST_ORDER_STATISTICS
+//! Порядковые статистики против обхода итератором
+void bench_order_stats(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+
+    const size_t queries = 1000;
+    std::mt19937 rng(11);
+    std::vector<std::pair<Key, Key>> ranges(queries);
+    for (auto &range : ranges) {
+        Key lo = Key(rng() % n);
+        range = {lo, Key(lo + rng() % (n / 10 + 1))};
+    }
+
+    size_t counted = 0;
+    double scan_ms = measure_ms([&] {
+        for (const auto &range : ranges) {
+            for (auto it = tree.find(range.first); it != tree.end() && it->first < range.second; ++it) ++counted;
+        }
+    });
+    double count_ms = measure_ms([&] {
+        for (const auto &range : ranges) counted += tree.count_range(range.first, range.second);
+    });
+    double select_ms = measure_ms([&] {
+        for (size_t i = 0; i < queries; ++i) counted += tree.select(rng() % n)->first;
+    });
+
+    std::cout << "order_stats: " << n << " ключей, count_range обходом " << scan_ms * 1e6 / queries
+              << " нс/оп, count_range " << count_ms * 1e6 / queries << " нс/оп, select "
+              << select_ms * 1e6 / queries << " нс/оп" << (counted == 0 ? "!" : "") << "\n";
+}
+#endif
+
+#ifdef BST_RANGE_AGGREGATES
+//! Сумма, минимум и максимум значений по диапазону: range_aggregate против обхода итератором
+void bench_range_aggregate(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+
+    const size_t queries = 1000;
+    std::mt19937 rng(13);
+    std::vector<std::pair<Key, Key>> ranges(queries);
+    for (auto &range : ranges) {
+        Key lo = Key(rng() % n);
+        range = {lo, Key(lo + rng() % (n / 10 + 1))};
+    }
+
+    double checksum = 0;
+    double scan_ms = measure_ms([&] {
+        for (const auto &range : ranges) {
+            RangeAggregate aggregate;
+            for (auto it = tree.find(range.first); it != tree.end() && it->first < range.second; ++it) {
+                aggregate.add(it->second);
+            }
+            checksum += aggregate.sum;
+        }
+    });
+    double tree_ms = measure_ms([&] {
+        for (const auto &range : ranges) checksum -= tree.range_aggregate(range.first, range.second).sum;
+    });
+
+    std::cout << "range_aggregate: " << n << " ключей, обход " << scan_ms * 1e6 / queries
+              << " нс/оп, range_aggregate " << tree_ms * 1e6 / queries << " нс/оп, "
+              << double(tree.bytes_reserved()) / n << " байт/элемент"
+              << (checksum > 1e-3 * n || checksum < -1e-3 * n ? "!" : "") << "\n";
+}
+#endif
+
+#ifdef BST_STATS
+//! Счётчики BST_STATS: снимок после вставок и поиска, цена stats() против полного обхода max_height()
+void bench_stats(size_t n) {
+    auto keys = random_keys(n);
+    BinarySearchTree tree;
+    for (Key key : keys) tree.insert(key, key * 0.5);
+    for (Key key : random_keys(n, 7)) tree.find(key);
+
+    TreeStats stats;
+    const size_t snapshots = 1000;
+    double stats_ms = measure_ms([&] {
+        for (size_t i = 0; i < snapshots; ++i) stats = tree.stats();
+    });
+    size_t height = 0;
+    double height_ms = measure_ms([&] { height = tree.max_height(); });
+
+    std::cout << "stats: " << n << " ключей, сравнений на поиск " << stats.comparisons_per_search()
+              << ", поворотов на вставку " << double(stats.rotations) / double(stats.inserts)
+              << ", перекрасок на вставку " << double(stats.color_flips) / double(stats.inserts)
+              << ", чёрная высота " << stats.black_height << ", высота " << height << " <= " << stats.height_bound
+              << ", stats() " << stats_ms * 1e6 / snapshots << " нс, max_height() " << height_ms * 1e6 << " нс\n"
+              << stats;
+}
+#endif
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(size_t n);
+};
+
+const Benchmark benchmarks[] = {
+    {"node_pool", bench_node_pool},
+    {"tree_insert", bench_tree_insert},
+    {"bulk_load", bench_bulk_load},
+    {"op_latency", bench_op_latency},
+    {"batch", bench_batch},
+    {"layout", bench_layout},
+    {"freeze", bench_freeze},
+    {"find_many", bench_find_many},
+    {"multimap", bench_multimap},
+    {"template", bench_template},
+    {"sharded", bench_sharded},
+    {"optimistic", bench_optimistic},
+    {"persistent", bench_persistent},
+    {"set_ops", bench_set_ops},
+    {"persist", bench_persist},
+    {"wal", bench_wal},
+    {"text", bench_text},
+    {"range_scan", bench_range_scan},
+    {"iterate", bench_iterate},
+    {"clone", bench_clone},
+    {"find_cache", bench_find_cache},
+#ifdef BST_ORDER_STATISTICS
+    {"order_stats", bench_order_stats},
+#endif
+#ifdef BST_RANGE_AGGREGATES
+    {"range_aggregate", bench_range_aggregate},
+#endif
+#ifdef BST_STATS
+    {"stats", bench_stats},
+#endif
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *only = argc > 1 ? argv[1] : nullptr;
+    size_t n = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    for (const Benchmark &bench : benchmarks) {
+        if (!only || std::strcmp(only, "all") == 0 || std::strcmp(only, bench.name) == 0) {
+            bench.run(n);
+        }
+    }
+    return 0;
+}
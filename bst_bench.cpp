@@ -0,0 +1,444 @@
+// Воспроизводимый набор замеров BinarySearchTree для сравнения между версиями
+// Сборка: cmake -S . -B build && cmake --build build --target bst_bench
+// Запуск: ./build/bst_bench [--sizes 1000,1000000] [--dists random,sequential,zipf]
+//                           [--workloads insert,find,mixed,scan,erase] [--format csv|json]
+//                           [--seed N] [--zipf-theta 0.99]
+// Без параметров - все распределения и нагрузки на размерах 1K, 10K, ..., 100M
+// (на 100M дерево занимает около 5 ГБ). Одна строка результата на пару
+// (нагрузка, распределение, размер): операций в секунду, p50 / p99 задержки
+// одной операции в наносекундах, байт пула узлов на элемент.
+// С макросом BST_ENGINE_BPLUS те же нагрузки идут на BPlusTree (цель bst_bench_bplus),
+// в столбце build тогда стоит bplus.
+#include "BST.h"
+#include "BPlusTree.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+//! Движок дерева выбирается при сборке, нагрузки пишутся против общего интерфейса
+#ifdef BST_ENGINE_BPLUS
+using Tree = BPlusTree;
+#else
+using Tree = BinarySearchTree;
+#endif
+
+enum class Dist { Random, Sequential, Zipf };
+
+const char *dist_name(Dist dist) {
+    switch (dist) {
+    case Dist::Random: return "random";
+    case Dist::Sequential: return "sequential";
+    case Dist::Zipf: return "zipf";
+    }
+    return "?";
+}
+
+//! Перемешивание fmix32 из MurmurHash3: взаимно однозначно на 32-битных числах,
+//! поэтому i -> mix(i) даёт различные "случайные" ключи без хранения перестановки
+uint32_t mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x;
+}
+
+/*!***********************************************************
+Ранги по закону Ципфа на [0, n), генератор Грея и др. (как в YCSB):
+ранг 0 самый частый. Подготовка - O(n) на сумму zeta(n),
+каждое значение - O(1).
+**************************************************************/
+class Zipfian
+{
+public:
+    Zipfian(uint64_t n, double theta) : _n(n), _theta(theta) {
+        double zeta2 = 1 + std::pow(0.5, theta);
+        for (uint64_t i = 1; i <= n; ++i) _zetan += std::pow(double(i), -theta);
+        _alpha = 1 / (1 - theta);
+        _eta = (1 - std::pow(2.0 / double(n), 1 - theta)) / (1 - zeta2 / _zetan);
+    }
+
+    template <typename Rng>
+    uint64_t operator()(Rng &rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * _zetan;
+        if (uz < 1) return 0;
+        if (uz < 1 + std::pow(0.5, _theta)) return std::min<uint64_t>(1, _n - 1);
+        uint64_t rank = uint64_t(double(_n) * std::pow(_eta * u - _eta + 1, _alpha));
+        return std::min(rank, _n - 1);
+    }
+
+private:
+    uint64_t _n;
+    double _theta;
+    double _zetan = 0;
+    double _alpha = 0;
+    double _eta = 0;
+};
+
+/*!***********************************************************
+Источник ключей одного распределения на n элементах:
+  - random: mix(i), различные ключи в случайном порядке
+  - sequential: i по возрастанию
+  - zipf: mix(ранг Ципфа), горячие ключи разбросаны по диапазону,
+    повторы ложатся на одни и те же элементы
+key(i) - i-й вставляемый ключ, probe() - ключ для поиска,
+fresh(i) при i >= n - ключ, которого нет среди key(0..n): mix
+взаимно однозначно, а ранги Ципфа меньше n.
+**************************************************************/
+class KeySource
+{
+public:
+    KeySource(Dist dist, size_t n, uint64_t seed, double theta)
+        : _dist(dist), _n(n), _rng(seed), _zipf(dist == Dist::Zipf ? n : 1, theta) {}
+
+    Key key(size_t i) {
+        switch (_dist) {
+        case Dist::Random: return mix(Key(i));
+        case Dist::Sequential: return Key(i);
+        case Dist::Zipf: return mix(Key(_zipf(_rng)));
+        }
+        return 0;
+    }
+
+    Key fresh(size_t i) const {
+        return _dist == Dist::Sequential ? Key(i) : mix(Key(i));
+    }
+
+    Key probe() {
+        switch (_dist) {
+        case Dist::Random: return mix(Key(std::uniform_int_distribution<size_t>(0, _n - 1)(_rng)));
+        case Dist::Sequential: return Key(_cursor++ % _n);
+        case Dist::Zipf: return mix(Key(_zipf(_rng)));
+        }
+        return 0;
+    }
+
+private:
+    Dist _dist;
+    size_t _n;
+    std::mt19937_64 _rng;
+    Zipfian _zipf;
+    size_t _cursor = 0;
+};
+
+//! Результат одного замера
+struct Result
+{
+    const char *workload;
+    Dist dist;
+    size_t size;
+    size_t ops = 0;
+    double seconds = 0;
+    double p50_ns = 0;
+    double p99_ns = 0;
+    double bytes_per_entry = 0;
+    size_t entries = 0;
+};
+
+/*!***********************************************************
+Прогон ops операций op(i) с замером общего времени и задержек.
+Часы опрашиваются только на каждой stride-й операции, чтобы их
+цена почти не попадала в операции в секунду. В p50 / p99 цена
+одного опроса часов (около 20 нс) входит, на малых размерах
+выборка меньше и p99 грубее.
+**************************************************************/
+template <typename Op>
+void run(Result &result, size_t ops, Op &&op) {
+    const size_t stride = std::max<size_t>(16, ops / 200000);
+    std::vector<double> samples;
+    samples.reserve(ops / stride + 1);
+    auto start = Clock::now();
+    for (size_t i = 0; i < ops; ++i) {
+        if (i % stride == 0) {
+            auto before = Clock::now();
+            op(i);
+            auto after = Clock::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(after - before).count());
+        } else {
+            op(i);
+        }
+    }
+    auto finish = Clock::now();
+    result.ops = ops;
+    result.seconds = std::chrono::duration<double>(finish - start).count();
+    if (!samples.empty()) {
+        auto at = [&](double q) {
+            auto nth = samples.begin() + ptrdiff_t(q * double(samples.size() - 1));
+            std::nth_element(samples.begin(), nth, samples.end());
+            return *nth;
+        };
+        result.p50_ns = at(0.50);
+        result.p99_ns = at(0.99);
+    }
+}
+
+//! Движок и макросы, с которыми собрано дерево: результаты разных сборок не сравнимы напрямую
+std::string build_flags() {
+#ifdef BST_ENGINE_BPLUS
+    // Макросы BST_* меняют только BinarySearchTree
+    return "bplus";
+#else
+    std::string flags;
+    // Без макросов BST_* лямбда не вызывается ни разу
+    [[maybe_unused]] auto add = [&](const char *flag) { flags += flags.empty() ? flag : std::string("+") + flag; };
+#ifdef BST_ORDER_STATISTICS
+    add("order_statistics");
+#endif
+#ifdef BST_RANGE_AGGREGATES
+    add("range_aggregates");
+#endif
+#ifdef BST_THREADED
+    add("threaded");
+#endif
+#ifdef BST_STATS
+    add("stats");
+#endif
+#ifdef BST_FIND_CACHE
+    add("find_cache");
+#endif
+    if (flags.empty()) flags = "default";
+    return flags;
+#endif
+}
+
+struct Options
+{
+    std::vector<size_t> sizes = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+    std::vector<Dist> dists = {Dist::Random, Dist::Sequential, Dist::Zipf};
+    std::vector<std::string> workloads = {"insert", "find", "mixed", "scan", "erase"};
+    bool json = false;
+    uint64_t seed = 42;
+    double theta = 0.99;
+};
+
+class Report
+{
+public:
+    explicit Report(bool json) : _json(json), _flags(build_flags()) {
+        if (!_json) {
+            std::cout << "workload,distribution,size,build,ops,seconds,ops_per_sec,p50_ns,p99_ns,"
+                         "bytes_per_entry,entries\n";
+        }
+    }
+
+    void print(const Result &r) const {
+        double ops_per_sec = r.seconds > 0 ? double(r.ops) / r.seconds : 0;
+        if (_json) {
+            std::cout << "{\"workload\":\"" << r.workload << "\",\"distribution\":\"" << dist_name(r.dist)
+                      << "\",\"size\":" << r.size << ",\"build\":\"" << _flags << "\",\"ops\":" << r.ops
+                      << ",\"seconds\":" << r.seconds << ",\"ops_per_sec\":" << ops_per_sec
+                      << ",\"p50_ns\":" << r.p50_ns << ",\"p99_ns\":" << r.p99_ns
+                      << ",\"bytes_per_entry\":" << r.bytes_per_entry << ",\"entries\":" << r.entries << "}\n";
+        } else {
+            std::cout << r.workload << ',' << dist_name(r.dist) << ',' << r.size << ',' << _flags << ',' << r.ops
+                      << ',' << r.seconds << ',' << ops_per_sec << ',' << r.p50_ns << ',' << r.p99_ns << ','
+                      << r.bytes_per_entry << ',' << r.entries << '\n';
+        }
+        std::cout.flush();
+    }
+
+private:
+    bool _json;
+    std::string _flags;
+};
+
+bool wanted(const Options &options, const char *workload) {
+    return std::find(options.workloads.begin(), options.workloads.end(), workload) != options.workloads.end();
+}
+
+/*!***********************************************************
+Все нагрузки на одном дереве размера n, по порядку:
+  - insert: n вставок в пустое дерево (у zipf повторы ключей
+    заменяют значение, поэтому элементов меньше n)
+  - find: n поисков
+  - mixed: n операций, 90% поиск, 5% вставка ключа, которого
+    нет в дереве, 5% удаление самого старого из лежащих в
+    дереве, поэтому размер дерева не меняется
+  - scan: обход всего дерева итератором, операция - один шаг
+  - erase: удаление всех элементов в порядке вставки, каждое
+    удаление находит свой ключ
+entries и bytes_per_entry - после нагрузки, у erase - до неё.
+Дерево строится всегда, даже если insert не запрошен.
+**************************************************************/
+void bench_size(const Options &options, const Report &report, Dist dist, size_t n) {
+    KeySource keys(dist, n, options.seed, options.theta);
+    Tree tree;
+    auto measure_memory = [&](Result &result) {
+        result.entries = tree.size();
+        result.bytes_per_entry = tree.size() ? double(tree.bytes_reserved()) / double(tree.size()) : 0;
+    };
+    auto finish = [&](Result &result) {
+        measure_memory(result);
+        report.print(result);
+    };
+
+    std::vector<Key> inserted(n);
+    for (size_t i = 0; i < n; ++i) inserted[i] = keys.key(i);
+
+    Result insert{"insert", dist, n};
+    run(insert, n, [&](size_t i) { tree.insert(inserted[i], Value(i)); });
+    if (wanted(options, "insert")) finish(insert);
+
+    // Ключи, лежащие в дереве, в порядке их появления: mixed и erase удаляют
+    // только их, каждый по одному разу. [oldest, live.size()) - ключи в дереве
+    std::vector<Key> live;
+    live.reserve(tree.size() + n / 20 + 1);
+    if (dist == Dist::Zipf) {
+        // Ключи повторяются: остаётся первое появление каждого, порядок появления сохраняется
+        std::vector<std::pair<Key, size_t>> first(n);
+        for (size_t i = 0; i < n; ++i) first[i] = {inserted[i], i};
+        std::sort(first.begin(), first.end());
+        auto same_key = [](const auto &a, const auto &b) { return a.first == b.first; };
+        first.erase(std::unique(first.begin(), first.end(), same_key), first.end());
+        std::sort(first.begin(), first.end(), [](const auto &a, const auto &b) { return a.second < b.second; });
+        for (const auto &entry : first) live.push_back(entry.first);
+    } else {
+        live = inserted;
+    }
+    size_t oldest = 0;
+
+    double sink = 0;
+    if (wanted(options, "find")) {
+        Result find{"find", dist, n};
+        run(find, n, [&](size_t) {
+            auto it = tree.find(keys.probe());
+            if (it != tree.end()) sink += it->second;
+        });
+        finish(find);
+    }
+
+    if (wanted(options, "mixed")) {
+        Result mixed{"mixed", dist, n};
+        size_t next = n;
+        run(mixed, n, [&](size_t i) {
+            switch (i % 20) {
+            case 0:
+                live.push_back(keys.fresh(next));
+                tree.insert(live.back(), Value(next));
+                ++next;
+                break;
+            case 10:
+                tree.erase(live[oldest++]);
+                break;
+            default: {
+                auto it = tree.find(keys.probe());
+                if (it != tree.end()) sink += it->second;
+            }
+            }
+        });
+        finish(mixed);
+    }
+
+    if (wanted(options, "scan")) {
+        Result scan{"scan", dist, n};
+        auto it = tree.cbegin();
+        run(scan, tree.size(), [&](size_t) {
+            sink += it->second;
+            ++it;
+        });
+        finish(scan);
+    }
+
+    if (wanted(options, "erase")) {
+        // Пул не возвращает память до разрушения дерева, поэтому память - до удаления
+        Result erase{"erase", dist, n};
+        measure_memory(erase);
+        run(erase, live.size() - oldest, [&](size_t i) { tree.erase(live[oldest + i]); });
+        report.print(erase);
+    }
+    if (sink < 0) std::cerr << sink;
+}
+
+[[noreturn]] void usage(const char *message) {
+    std::cerr << "bst_bench: " << message << "\n"
+              << "usage: bst_bench [--sizes N,N,...] [--dists random,sequential,zipf]\n"
+              << "                 [--workloads insert,find,mixed,scan,erase] [--format csv|json]\n"
+              << "                 [--seed N] [--zipf-theta T]\n";
+    std::exit(2);
+}
+
+std::vector<std::string> split_list(const std::string &text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    for (std::string item; std::getline(stream, item, ',');) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+//! Размер с необязательным суффиксом K / M: 1K = 1000
+size_t parse_size(const std::string &text) {
+    char *end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) usage(("неверный размер " + text).c_str());
+    if (*end == 'K' || *end == 'k') value *= 1000, ++end;
+    else if (*end == 'M' || *end == 'm') value *= 1000000, ++end;
+    if (*end != '\0' || value == 0 || value > UINT32_MAX) usage(("неверный размер " + text).c_str());
+    return size_t(value);
+}
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(("нет значения для " + arg).c_str());
+        std::string value = argv[++i];
+        if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const std::string &item : split_list(value)) options.sizes.push_back(parse_size(item));
+        } else if (arg == "--dists") {
+            options.dists.clear();
+            for (const std::string &item : split_list(value)) {
+                if (item == "random") options.dists.push_back(Dist::Random);
+                else if (item == "sequential") options.dists.push_back(Dist::Sequential);
+                else if (item == "zipf") options.dists.push_back(Dist::Zipf);
+                else usage(("неизвестное распределение " + item).c_str());
+            }
+        } else if (arg == "--workloads") {
+            options.workloads = split_list(value);
+            for (const std::string &item : options.workloads) {
+                if (item != "insert" && item != "find" && item != "mixed" && item != "scan" && item != "erase") {
+                    usage(("неизвестная нагрузка " + item).c_str());
+                }
+            }
+        } else if (arg == "--format") {
+            if (value != "csv" && value != "json") usage(("неизвестный формат " + value).c_str());
+            options.json = value == "json";
+        } else if (arg == "--seed") {
+            options.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--zipf-theta") {
+            options.theta = std::strtod(value.c_str(), nullptr);
+            if (!(options.theta > 0 && options.theta < 1)) usage("zipf-theta должен быть в (0, 1)");
+        } else {
+            usage(("неизвестный параметр " + arg).c_str());
+        }
+    }
+    if (options.sizes.empty() || options.dists.empty() || options.workloads.empty()) usage("пустой список");
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options = parse_options(argc, argv);
+    Report report(options.json);
+    for (size_t n : options.sizes) {
+        for (Dist dist : options.dists) {
+            bench_size(options, report, dist, n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Нагрузочная проверка OptimisticTree: поиски без блокировок против писателей и clear()
+// Сборка под ThreadSanitizer (проверка ведётся прежде всего им):
+//   cmake -S . -B build-tsan -DCMAKE_BUILD_TYPE=RelWithDebInfo -DCMAKE_CXX_FLAGS=-fsanitize=thread
+//   cmake --build build-tsan --target bst_stress && ./build-tsan/bst_stress
+// Запуск: bst_stress [--ops N] [--readers N] [--writers N] [--clears N]
+// Без TSan проверяются только значения, которые видят читатели. Код возврата
+// 0 - все проверки прошли, 1 - читатель увидел неверное значение или потерял ключ.
+#include "OptimisticTree.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    int ops = 100000;   //!< изменений на одного писателя
+    int readers = 4;
+    int writers = 2;
+    int clears = 200;   //!< циклов заполнения и clear()
+};
+
+//! Значение, которое всегда лежит при ключе: по нему читатель узнаёт порванную копию
+Value value_of(Key key) {
+    return Value(key) * 0.5 + 1;
+}
+
+[[noreturn]] void fail(const std::string &message) {
+    std::cerr << "bst_stress: " << message << "\n";
+    std::exit(1);
+}
+
+/*!***********************************************************
+Читатели против писателей в режиме mode:
+  - чётные ключи меньше stable_keys вставлены заранее и никогда
+    не удаляются: читатель обязан найти каждый с верным значением
+  - писатели вставляют и удаляют остальные ключи из [0, 2 *
+    stable_keys) и время от времени вставляют пачку, поэтому
+    спуски читателей идут сквозь повороты и перекраски
+  - любое найденное значение должно равняться value_of(key)
+**************************************************************/
+void readers_vs_writers(const Options &options, KeyMode mode) {
+    constexpr Key stable_keys = 2000;
+    BasicOptimisticTree<Key, Value> tree(mode);
+    for (Key key = 0; key < stable_keys; key += 2) tree.insert(key, value_of(key));
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> found{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < options.readers; ++r) {
+        readers.emplace_back([&, r] {
+            std::mt19937 rng(r);
+            uint64_t hits = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                Key key = rng() % (2 * stable_keys);
+                auto value = tree.find(key);
+                if (key < stable_keys && key % 2 == 0 && !value) fail("потерян ключ " + std::to_string(key));
+                if (value && *value != value_of(key)) fail("неверное значение ключа " + std::to_string(key));
+                hits += value.has_value();
+            }
+            found.fetch_add(hits, std::memory_order_relaxed);
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < options.writers; ++w) {
+        writers.emplace_back([&, w] {
+            std::mt19937 rng(100 + w);
+            for (int i = 0; i < options.ops; ++i) {
+                Key key = rng() % (2 * stable_keys);
+                if (key < stable_keys && key % 2 == 0) continue;
+                if (rng() % 2) {
+                    tree.insert(key, value_of(key));
+                } else {
+                    tree.erase(key);
+                }
+                if (i % 1000 == 0) {
+                    std::vector<std::pair<Key, Value>> batch;
+                    for (int j = 0; j < 50; ++j) {
+                        Key odd = stable_keys + 1 + 2 * Key(rng() % (stable_keys / 2 - 1));
+                        batch.emplace_back(odd, value_of(odd));
+                    }
+                    tree.insert_batch(std::move(batch));
+                }
+            }
+        });
+    }
+    for (auto &writer : writers) writer.join();
+    stop = true;
+    for (auto &reader : readers) reader.join();
+
+    std::cout << "readers_vs_writers," << (mode == KeyMode::Unique ? "unique" : "multi")
+              << ",found=" << found.load() << ",fallbacks=" << tree.fallbacks() << ",size=" << tree.size() << '\n';
+}
+
+/*!***********************************************************
+Читатели против clear(): писатель заполняет дерево и сбрасывает
+его clear(), которая освобождает старое дерево после выхода его
+читателей из эпохи. Читатель, спускающийся по освобождённым
+узлам, попадёт под TSan (или ASan) как use-after-free.
+**************************************************************/
+void readers_vs_clear(const Options &options) {
+    constexpr Key key_range = 5000;
+    OptimisticTree tree;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < options.readers; ++r) {
+        readers.emplace_back([&, r] {
+            std::mt19937 rng(r);
+            while (!stop.load(std::memory_order_relaxed)) {
+                Key key = rng() % key_range;
+                auto value = tree.find(key);
+                if (value && *value != value_of(key)) fail("неверное значение после clear, ключ " + std::to_string(key));
+            }
+        });
+    }
+    for (int round = 0; round < options.clears; ++round) {
+        for (Key i = 0; i < 500; ++i) {
+            Key key = i * 7 % key_range;
+            tree.insert(key, value_of(key));
+        }
+        tree.clear();
+    }
+    stop = true;
+    for (auto &reader : readers) reader.join();
+    if (tree.size() != 0) fail("после clear() дерево не пусто");
+    std::cout << "readers_vs_clear,rounds=" << options.clears << '\n';
+}
+
+[[noreturn]] void usage(const char *message) {
+    std::cerr << "bst_stress: " << message << "\n"
+              << "usage: bst_stress [--ops N] [--readers N] [--writers N] [--clears N]\n";
+    std::exit(2);
+}
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(("нет значения для " + arg).c_str());
+        int value = std::atoi(argv[++i]);
+        if (value < 0 || (value == 0 && arg != "--clears")) usage(("неверное значение для " + arg).c_str());
+        if (arg == "--ops") options.ops = value;
+        else if (arg == "--readers") options.readers = value;
+        else if (arg == "--writers") options.writers = value;
+        else if (arg == "--clears") options.clears = value;
+        else usage(("неизвестный параметр " + arg).c_str());
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options = parse_options(argc, argv);
+    readers_vs_writers(options, KeyMode::Unique);
+    readers_vs_writers(options, KeyMode::Multi);
+    readers_vs_clear(options);
+    std::cout << "ok\n";
+    return 0;
+}